@@ -0,0 +1,331 @@
+#include "assembler.hpp"
+#include "diagnostics.hpp"
+
+#include <iostream>
+#include <stdexcept>
+
+using Kind = operand::Kind;
+
+static bool fits8( int64_t v ){
+    return v >= -128 && v <= 127;
+}
+
+static bool fits32( int64_t v ){
+    return v >= INT32_MIN && v <= INT32_MAX;
+}
+
+static int code( Reg r ){
+    return int( r );
+}
+
+assembler::assembler( int64_t word ) : word( word ) {}
+
+void assembler::encode( const std::vector< instruction >& code ){
+    for( auto& i : code ){
+        encode( i );
+    }
+    current = nullptr;
+}
+
+void assembler::encode( const instruction& i ){
+    using enum Opcode;
+    current = &i;
+    auto& ops = i.operands;
+    auto is = [ & ]( size_t n, Kind k ){ return ops.size() > n && ops[ n ].kind == k; };
+
+    switch( i.op ){
+        case Label:
+            if( !labels.emplace( ops[ 0 ].symbol, out.size() ).second ){
+                error( "label defined twice" );
+            }
+            break;
+        case Mov:
+            if( is( 0, Kind::Register ) ){
+                op( { 0x89 }, ops[ 0 ].reg, ops[ 1 ] );
+            } else if( is( 0, Kind::Memory ) && is( 1, Kind::Register ) ){
+                op( { 0x8B }, ops[ 1 ].reg, ops[ 0 ] );
+            } else if( is( 0, Kind::Immediate ) && is( 1, Kind::Register ) && word == 4 ){
+                rex( false, 0, ops[ 1 ] );
+                byte( 0xB8 + ( code( ops[ 1 ].reg ) & 7 ) );
+                immediate( ops[ 0 ], false );
+            } else if( is( 0, Kind::Immediate ) && is( 1, Kind::Register )
+                       && ops[ 0 ].symbol.empty() && !fits32( ops[ 0 ].value ) ){
+                // movabs
+                rex( true, 0, ops[ 1 ] );
+                byte( 0xB8 + ( code( ops[ 1 ].reg ) & 7 ) );
+                field( ops[ 0 ].value, 8 );
+            } else if( is( 0, Kind::Immediate ) ){
+                op( { 0xC7 }, 0, ops[ 1 ] );
+                immediate( ops[ 0 ], false );
+            } else {
+                error( "unsupported operands" );
+            }
+            break;
+        case Movb:
+            // without a REX prefix only %al..%bl have byte names
+            if( !is( 0, Kind::Register ) || ops[ 0 ].reg >= Reg::Sp ){
+                error( "unsupported operands" );
+            }
+            op( { 0x88 }, ops[ 0 ].reg, ops[ 1 ], false );
+            break;
+        case Lea:
+            if( !is( 0, Kind::Memory ) || !is( 1, Kind::Register ) ){
+                error( "unsupported operands" );
+            }
+            op( { 0x8D }, ops[ 1 ].reg, ops[ 0 ] );
+            break;
+        case Push:
+        case Pop:
+            if( is( 0, Kind::Register ) ){
+                rex( false, 0, ops[ 0 ] );
+                byte( ( i.op == Push ? 0x50 : 0x58 ) + ( code( ops[ 0 ].reg ) & 7 ) );
+            } else if( is( 0, Kind::Memory ) ){
+                if( i.op == Push ){
+                    op( { 0xFF }, 6, ops[ 0 ], false );
+                } else {
+                    op( { 0x8F }, 0, ops[ 0 ], false );
+                }
+            } else if( is( 0, Kind::Immediate ) && i.op == Push ){
+                bool small = ops[ 0 ].symbol.empty() && fits8( ops[ 0 ].value );
+                byte( small ? 0x6A : 0x68 );
+                immediate( ops[ 0 ], small );
+            } else {
+                error( "unsupported operands" );
+            }
+            break;
+        case Add: arithmetic( i, 0, 0x01, 0x03 ); break;
+        case Sub: arithmetic( i, 5, 0x29, 0x2B ); break;
+        case Xor: arithmetic( i, 6, 0x31, 0x33 ); break;
+        case Cmp: arithmetic( i, 7, 0x39, 0x3B ); break;
+        case Test:
+            if( is( 0, Kind::Register ) ){
+                op( { 0x85 }, ops[ 0 ].reg, ops[ 1 ] );
+            } else if( is( 1, Kind::Register ) && is( 0, Kind::Memory ) ){
+                op( { 0x85 }, ops[ 1 ].reg, ops[ 0 ] );
+            } else {
+                error( "unsupported operands" );
+            }
+            break;
+        case Imul:
+            if( ops.size() == 3 && is( 0, Kind::Immediate ) && is( 2, Kind::Register ) ){
+                bool small = ops[ 0 ].symbol.empty() && fits8( ops[ 0 ].value );
+                op( { uint8_t( small ? 0x6B : 0x69 ) }, ops[ 2 ].reg, ops[ 1 ] );
+                immediate( ops[ 0 ], small );
+            } else if( ops.size() == 2 && is( 1, Kind::Register ) && !is( 0, Kind::Immediate ) ){
+                op( { 0x0F, 0xAF }, ops[ 1 ].reg, ops[ 0 ] );
+            } else {
+                error( "unsupported operands" );
+            }
+            break;
+        case Div: op( { 0xF7 }, 6, ops[ 0 ] ); break;
+        case Neg: op( { 0xF7 }, 3, ops[ 0 ] ); break;
+        case Shr:
+            if( !is( 0, Kind::Immediate ) ){
+                error( "unsupported operands" );
+            }
+            if( ops[ 0 ].value == 1 ){
+                op( { 0xD1 }, 5, ops[ 1 ] );
+            } else {
+                op( { 0xC1 }, 5, ops[ 1 ] );
+                byte( ops[ 0 ].value );
+            }
+            break;
+        case Je:   branch( { 0x0F, 0x84 }, ops[ 0 ] ); break;
+        case Jne:  branch( { 0x0F, 0x85 }, ops[ 0 ] ); break;
+        case Jae:  branch( { 0x0F, 0x83 }, ops[ 0 ] ); break;
+        case Jmp:  branch( { 0xE9 }, ops[ 0 ] ); break;
+        case Call: branch( { 0xE8 }, ops[ 0 ] ); break;
+        case Ret:   byte( 0xC3 ); break;
+        case Leave: byte( 0xC9 ); break;
+        case RepMovsb:
+            byte( 0xF3 );
+            byte( 0xA4 );
+            break;
+        case Int:
+            byte( 0xCD );
+            byte( ops[ 0 ].value );
+            break;
+        case Syscall:
+            byte( 0x0F );
+            byte( 0x05 );
+            break;
+    }
+}
+
+void assembler::link( uint64_t base, const std::map< std::string, uint64_t >& symbols ){
+    for( auto& f : fixups ){
+        uint64_t target;
+        if( auto l = labels.find( f.symbol ); l != labels.end() ){
+            target = base + l->second;
+        } else if( auto s = symbols.find( f.symbol ); s != symbols.end() ){
+            target = s->second;
+        } else {
+            error( "undefined symbol " + f.symbol );
+        }
+
+        int64_t value = int64_t( target ) + f.addend;
+        if( f.relative ){
+            value -= int64_t( base + f.at + 4 );
+        }
+        // absolute addresses are sign-extended in 64-bit mode
+        bool fits = f.relative || word == 8 ? fits32( value )
+                                            : value >= 0 && value <= int64_t( UINT32_MAX );
+        if( !fits ){
+            error( "address of " + f.symbol + " does not fit in 32 bits" );
+        }
+        for( int b = 0; b < 4; ++b ){
+            out[ f.at + b ] = char( uint64_t( value ) >> ( 8 * b ) );
+        }
+    }
+}
+
+size_t assembler::offset( const std::string& label ) const {
+    auto l = labels.find( label );
+    if( l == labels.end() ){
+        diagnostics() << "Error while assembling:\n  undefined symbol " << label << '\n';
+        throw std::invalid_argument( "undefined symbol" );
+    }
+    return l->second;
+}
+
+void assembler::byte( uint64_t b ){
+    out += char( b );
+}
+
+void assembler::field( int64_t value, int bytes ){
+    for( int b = 0; b < bytes; ++b ){
+        byte( uint64_t( value ) >> ( 8 * b ) );
+    }
+}
+
+void assembler::address( const std::string& symbol, int64_t value, bool relative ){
+    if( !symbol.empty() ){
+        fixups.push_back( { out.size(), symbol, value, relative } );
+        value = 0;
+    } else if( !fits32( value ) && !( word == 4 && value >= 0 && value <= int64_t( UINT32_MAX ) ) ){
+        error( "value does not fit in 32 bits" );
+    }
+    field( value, 4 );
+}
+
+void assembler::immediate( const operand& o, bool small ){
+    if( small ){
+        byte( o.value );
+    } else {
+        address( o.symbol, o.value );
+    }
+}
+
+void assembler::op( std::initializer_list< uint8_t > opcode, Reg reg, const operand& rm,
+                    bool wide )
+{
+    op( opcode, code( reg ), rm, wide );
+}
+
+void assembler::op( std::initializer_list< uint8_t > opcode, int ext, const operand& rm,
+                    bool wide )
+{
+    if( rm.kind != Kind::Register && rm.kind != Kind::Memory ){
+        error( "unsupported operands" );
+    }
+    rex( wide, ext, rm );
+    for( uint8_t b : opcode ){
+        byte( b );
+    }
+    modrm( ext, rm );
+}
+
+void assembler::rex( bool wide, int reg, const operand& rm ){
+    int high = ( reg & 8 ? 4 : 0 )
+             | ( rm.kind == Kind::Memory && rm.index != Reg::None && ( code( rm.index ) & 8 ) ? 2 : 0 )
+             | ( rm.reg != Reg::None && ( code( rm.reg ) & 8 ) ? 1 : 0 );
+    if( word != 8 ){
+        if( high ){
+            error( "register not available on i386" );
+        }
+        return;
+    }
+    if( wide || high ){
+        byte( 0x40 | ( wide ? 8 : 0 ) | high );
+    }
+}
+
+/* mod 11 addresses the register itself. Otherwise a SIB byte follows when
+ * there is an index, a base that shares the SIB escape (%esp, %r12) or, in
+ * 64-bit mode where a plain disp32 is %rip-relative, no base. A base sharing
+ * the no-base encoding (%ebp, %r13) needs a displacement even when it is zero.
+ */
+void assembler::modrm( int reg, const operand& rm ){
+    reg &= 7;
+    if( rm.kind == Kind::Register ){
+        byte( 0xC0 | reg << 3 | ( code( rm.reg ) & 7 ) );
+        return;
+    }
+
+    bool based = rm.reg != Reg::None;
+    int base = based ? code( rm.reg ) & 7 : 5;
+    bool sib = rm.index != Reg::None || base == 4 || ( !based && word == 8 );
+
+    int mod = 2;
+    if( !based ){
+        mod = 0;
+    } else if( rm.symbol.empty() && rm.value == 0 && base != 5 ){
+        mod = 0;
+    } else if( rm.symbol.empty() && fits8( rm.value ) ){
+        mod = 1;
+    }
+
+    byte( mod << 6 | reg << 3 | ( sib ? 4 : base ) );
+    if( sib ){
+        int scale = rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0;
+        int index = rm.index == Reg::None ? 4 : code( rm.index ) & 7;
+        byte( scale << 6 | index << 3 | base );
+    }
+    if( mod == 1 ){
+        byte( rm.value );
+    } else if( mod == 2 || !based ){
+        address( rm.symbol, rm.value );
+    }
+}
+
+void assembler::arithmetic( const instruction& i, int ext, uint8_t store, uint8_t load ){
+    auto& src = i.operands[ 0 ];
+    auto& dst = i.operands[ 1 ];
+    if( src.kind == Kind::Immediate ){
+        bool small = src.symbol.empty() && fits8( src.value );
+        if( !small && dst.is_reg( Reg::Ax ) ){
+            // the accumulator has a form without ModRM, one byte shorter
+            rex( true, 0, dst );
+            byte( uint8_t( ext * 8 + 5 ) );
+        } else {
+            op( { uint8_t( small ? 0x83 : 0x81 ) }, ext, dst );
+        }
+        immediate( src, small );
+    } else if( src.kind == Kind::Register ){
+        op( { store }, src.reg, dst );
+    } else if( src.kind == Kind::Memory && dst.kind == Kind::Register ){
+        op( { load }, dst.reg, src );
+    } else {
+        error( "unsupported operands" );
+    }
+}
+
+void assembler::branch( std::initializer_list< uint8_t > opcode, const operand& target ){
+    if( target.kind != Kind::Symbol ){
+        error( "unsupported operands" );
+    }
+    for( uint8_t b : opcode ){
+        byte( b );
+    }
+    address( target.symbol, 0, true );
+}
+
+void assembler::error( std::string str ){
+    diagnostics() << "Error while assembling";
+    if( current ){
+        std::string text = to_string( *current, word );
+        diagnostics() << " '" << text.substr( 2, text.size() - 3 ) << "'";
+    }
+    diagnostics() << ":\n  " << str << '\n';
+    throw std::invalid_argument( "assembler" );
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "instruction.hpp"
+
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <vector>
+
+/* Encodes the instructions the backend emits into i386 or x86-64 machine code.
+ *
+ * Jumps and calls always take a 32-bit displacement and symbolic addresses are
+ * always 32 bits wide, so the size of the code does not depend on where it is
+ * placed: encode() lays everything out once, link() patches in the addresses.
+ */
+class assembler {
+  public:
+    explicit assembler( int64_t word );
+
+    void encode( const std::vector< instruction >& code );
+    void encode( const instruction& i );
+
+    // places the code at base; symbols holds every address that is not a label
+    void link( uint64_t base, const std::map< std::string, uint64_t >& symbols );
+
+    const std::string& bytes() const { return out; }
+    size_t size() const { return out.size(); }
+    size_t offset( const std::string& label ) const;
+
+  private:
+    struct fixup {
+        size_t at;
+        std::string symbol;
+        int64_t addend;
+        bool relative;      // from the end of the field, otherwise absolute
+    };
+
+    int64_t word;
+    std::string out;
+    std::vector< fixup > fixups;
+    std::map< std::string, size_t > labels;
+
+    void byte( uint64_t b );
+    void field( int64_t value, int bytes );
+    void address( const std::string& symbol, int64_t value, bool relative = false );
+    void immediate( const operand& o, bool small );
+
+    // REX, the opcode bytes and the ModRM addressing of rm, reg in the middle field
+    void op( std::initializer_list< uint8_t > opcode, Reg reg, const operand& rm,
+             bool wide = true );
+    void op( std::initializer_list< uint8_t > opcode, int ext, const operand& rm,
+             bool wide = true );
+    void modrm( int reg, const operand& rm );
+    void rex( bool wide, int reg, const operand& rm );
+
+    void arithmetic( const instruction& i, int ext, uint8_t store, uint8_t load );
+    void branch( std::initializer_list< uint8_t > opcode, const operand& target );
+
+    const instruction* current = nullptr;
+    [[noreturn]] void error( std::string str );
+};
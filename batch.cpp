@@ -0,0 +1,115 @@
+#include "batch.hpp"
+#include "diagnostics.hpp"
+#include "elf.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+
+void load( parser& p, const std::string& input, bool from_ir ){
+    if( from_ir ){
+        p.read_ir( input );
+    } else {
+        p.parse( input );
+    }
+}
+
+void write_outputs( const program& compiled, const std::string& output, bool keep_as, bool exe,
+                    statistics& stats )
+{
+    if( keep_as ){
+        std::string text;
+        {
+            auto timer = stats.time( "assembly text" );
+            append( text, compiled );
+        }
+        auto timer = stats.time( "write" );
+        write_file( text, output + ".s" );
+        stats.add( "bytes written", text.size() );
+    }
+    if( exe ){
+        std::string image;
+        {
+            auto timer = stats.time( "assemble and link" );
+            image = executable( compiled );
+        }
+        auto timer = stats.time( "write" );
+        write_executable( image, output );
+        stats.add( "bytes written", image.size() );
+    }
+}
+
+void print_counters( const std::vector< std::pair< std::string, size_t > >& counters ){
+    for( auto [ name, hits ] : counters ){
+        std::cerr << name << ": " << hits << '\n';
+    }
+}
+
+int batch( const std::vector< std::string >& inputs, const std::vector< std::string >& outputs,
+           options opts, const stages& want, statistics& stats )
+{
+    size_t jobs = opts.jobs;
+    opts.jobs = 1;
+
+    std::vector< std::ostringstream > logs( inputs.size() );
+    std::vector< bool > failed( inputs.size(), false );
+    std::vector< std::vector< std::pair< std::string, size_t > > > counters( inputs.size() );
+    std::vector< statistics > measured( inputs.size() );
+
+    parallel_for( inputs.size(), jobs, [ & ]( size_t i, size_t ){
+        collect_diagnostics collect( logs[ i ] );
+        try {
+            parser p( opts );
+            load( p, inputs[ i ], want.from_ir );
+            if( want.emit_ir ){
+                p.write_ir( outputs[ i ] );
+            } else {
+                program compiled = p.compile();
+                write_outputs( compiled, outputs[ i ], want.keep_as, true, measured[ i ] );
+                counters[ i ] = p.peephole_counters();
+            }
+            measured[ i ].merge( p.stats() );
+        } catch( std::invalid_argument& e ){
+            failed[ i ] = true;
+        } catch( std::filesystem::filesystem_error& e ){
+            diagnostics() << "Error while writing " << outputs[ i ] << ":\n  " << e.what() << '\n';
+            failed[ i ] = true;
+        } catch( std::exception& e ){
+            diagnostics() << "Error:\n  " << e.what() << '\n';
+            failed[ i ] = true;
+        } catch( ... ){
+            diagnostics() << "Error:\n  unknown failure\n";
+            failed[ i ] = true;
+        }
+    } );
+
+    size_t failures = 0;
+    for( size_t i = 0; i < inputs.size(); ++i ){
+        std::string log = logs[ i ].str();
+        if( !log.empty() ){
+            std::cerr << inputs[ i ] << ":\n" << log;
+        }
+        failures += failed[ i ];
+        stats.merge( measured[ i ] );
+    }
+
+    if( want.peephole_stats ){
+        std::vector< std::pair< std::string, size_t > > total;
+        for( size_t i = 0; i < inputs.size(); ++i ){
+            total.resize( std::max( total.size(), counters[ i ].size() ) );
+            for( size_t c = 0; c < counters[ i ].size(); ++c ){
+                total[ c ].first = counters[ i ][ c ].first;
+                total[ c ].second += counters[ i ][ c ].second;
+            }
+        }
+        print_counters( total );
+    }
+
+    if( failures ){
+        std::cerr << failures << " of " << inputs.size() << " files failed\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "parser.hpp"
+#include "stats.hpp"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// what to read the inputs as and what to write for them
+struct stages {
+    bool from_ir = false;
+    bool emit_ir = false;
+    bool keep_as = false;
+    bool peephole_stats = false;
+};
+
+// reads input as source, or with from_ir as written by --emit-ir
+void load( parser& p, const std::string& input, bool from_ir );
+
+// writes the assembly of compiled with keep_as, and the executable unless exe is false
+void write_outputs( const program& compiled, const std::string& output, bool keep_as, bool exe,
+                    statistics& stats );
+
+void print_counters( const std::vector< std::pair< std::string, size_t > >& counters );
+
+/* Compiles each input to its output on a parser of its own, up to opts.jobs
+ * files at a time with one thread each. A file's diagnostics are held back and
+ * printed together under its name once every file is done, in input order.
+ * A file that fails for any reason only fails itself; the result is 1 if any
+ * did.
+ */
+int batch( const std::vector< std::string >& inputs, const std::vector< std::string >& outputs,
+           options opts, const stages& want, statistics& stats );
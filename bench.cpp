@@ -0,0 +1,186 @@
+#include "bench_corpus.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "dimcli/libs/dimcli/cli.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+/* Throughput of the front end and the backend over inputs from
+ * examples/main.td up to --max-mb of generated source. Every phase is repeated
+ * until it has run for --min-time, so small inputs are timed as reliably as
+ * large ones. MB/s that fall as the input grows point at quadratic behaviour.
+ *
+ * Items are functions, except for the dictionary, where they are lookups of
+ * the identifiers in the source.
+ */
+
+using clock_type = std::chrono::steady_clock;
+
+static double seconds_since( clock_type::time_point start ){
+    return std::chrono::duration< double >( clock_type::now() - start ).count();
+}
+
+struct input {
+    std::string name;
+    std::string source;
+    size_t functions;
+};
+
+struct rates {
+    double seconds = 0;     // per run
+    size_t runs = 0;
+};
+
+// runs work until min_time has passed, timing only what it returns
+template< class F >
+static rates repeat( double min_time, F&& work ){
+    rates r;
+    double total = 0;
+    do {
+        total += work();
+        ++r.runs;
+    } while( total < min_time );
+    r.seconds = total / r.runs;
+    return r;
+}
+
+static void row( const std::string& phase, const input& in, size_t bytes, size_t items,
+                 const rates& r )
+{
+    std::cout << std::left << std::setw( 12 ) << in.name << std::setw( 12 ) << phase
+              << std::right << std::fixed << std::setprecision( 2 )
+              << std::setw( 12 ) << bytes / 1e6 / r.seconds
+              << std::setw( 14 ) << std::setprecision( 0 ) << items / r.seconds
+              << std::setw( 12 ) << std::setprecision( 3 ) << r.seconds * 1000
+              << std::setw( 8 ) << r.runs << '\n';
+}
+
+static void bench( const input& in, const options& opts, double min_time ){
+    // the dictionary as the parser fills it, looked up with every word of the source
+    std::vector< std::string > words = corpus_words( in.source );
+    size_t word_bytes = 0;
+    for( auto& w : words ){
+        word_bytes += w.size();
+    }
+    rates lookups = repeat( min_time, [ & ]{
+        dictionary dict;
+        for( size_t w = 0; w < words.size(); ++w ){
+            dict.add_word( words[ w ], Token::Identifier, w );
+        }
+        auto start = clock_type::now();
+        size_t found = 0;
+        for( auto& w : words ){
+            found += dict.get_token( w ) != Token::None;
+        }
+        double seconds = seconds_since( start );
+        if( found != words.size() ){
+            std::cerr << "dictionary lost words\n";
+        }
+        return seconds;
+    } );
+    row( "dictionary", in, word_bytes, words.size(), lookups );
+
+    rates parsing, lowering, translating;
+    double total = 0;
+    do {
+        parser p( opts );
+        auto start = clock_type::now();
+        p.parse_source( in.source );
+        parsing.seconds += seconds_since( start );
+
+        start = clock_type::now();
+        p.to_triples();
+        lowering.seconds += seconds_since( start );
+
+        // from the triples just made, to_triples does not lower again
+        start = clock_type::now();
+        p.translate( "/dev/null" );
+        translating.seconds += seconds_since( start );
+
+        total = parsing.seconds + lowering.seconds + translating.seconds;
+        ++parsing.runs;
+    } while( total < 3 * min_time );
+
+    lowering.runs = translating.runs = parsing.runs;
+    for( rates* r : { &parsing, &lowering, &translating } ){
+        r->seconds /= r->runs;
+    }
+    row( "parse", in, in.source.size(), in.functions, parsing );
+    row( "to_triples", in, in.source.size(), in.functions, lowering );
+    row( "translate", in, in.source.size(), in.functions, translating );
+}
+
+int main( int argc, char** argv ){
+    Dim::Cli cli;
+
+    std::string examples;
+    cli.opt( &examples, "examples", "examples" ).desc( "directory holding main.td" );
+
+    double max_mb;
+    cli.opt( &max_mb, "max-mb", 10.0 ).desc( "largest generated input; 100 for the full suite" );
+
+    double min_time;
+    cli.opt( &min_time, "min-time", 0.2 ).desc( "seconds to repeat each phase for at least" );
+
+    corpus_shape shape;
+    cli.opt( &shape.statements, "statements", shape.statements )
+        .desc( "statements per generated function" );
+    cli.opt( &shape.depth, "depth", shape.depth ).desc( "depth of generated expressions" );
+    cli.opt( &shape.identifiers, "identifiers", shape.identifiers )
+        .desc( "variables per generated function" );
+    cli.opt( &shape.literals, "literals", shape.literals )
+        .desc( "literals in one long line per generated function" );
+    cli.opt( &shape.seed, "seed", shape.seed ).desc( "of the generator" );
+
+    std::string write;
+    cli.opt( &write, "write", "" )
+        .desc( "only write a corpus of --max-mb to this file, for other tools" );
+
+    options opts;
+    cli.opt( &opts.optimize, "O optimize", false ).desc( "run the peephole optimizer" );
+    cli.opt( &opts.target, "t target", "i386" ).desc( "i386 or x86-64" );
+    cli.opt( &opts.jobs, "j jobs", 1 ).desc( "threads translate generates functions on" );
+
+    if (!cli.parse(argc, argv))
+        return cli.printError( std::cerr );
+
+    if( !write.empty() ){
+        std::ofstream( write, std::ios::binary )
+            << generate_corpus( shape_for_size( shape, size_t( max_mb * 1e6 ) ) );
+        return 0;
+    }
+
+    std::vector< input > inputs;
+    std::ifstream main_td( examples + "/main.td" );
+    if( main_td ){
+        inputs.push_back( { "main.td", std::string( std::istreambuf_iterator< char >( main_td ),
+                                                    std::istreambuf_iterator< char >() ), 1 } );
+    }
+    for( double mb = 0.01; mb <= max_mb * 1.001; mb *= 10 ){
+        corpus_shape s = shape_for_size( shape, size_t( mb * 1e6 ) );
+        std::ostringstream name;
+        name << mb << " MB";
+        inputs.push_back( { name.str(), generate_corpus( s ), s.functions + 1 } );
+    }
+
+    std::cout << std::left << std::setw( 12 ) << "input" << std::setw( 12 ) << "phase"
+              << std::right << std::setw( 12 ) << "MB/s" << std::setw( 14 ) << "items/s"
+              << std::setw( 12 ) << "ms/run" << std::setw( 8 ) << "runs" << '\n';
+    for( auto& in : inputs ){
+        try {
+            bench( in, opts, min_time );
+        } catch( std::invalid_argument& e ){
+            std::cerr << in.name << " does not compile\n";
+            return 1;
+        } catch( std::exception& e ){
+            std::cerr << in.name << " failed: " << e.what() << '\n';
+            return 1;
+        }
+    }
+}
@@ -0,0 +1,138 @@
+#include "bench_corpus.hpp"
+
+#include <algorithm>
+#include <cctype>
+
+namespace {
+
+// splitmix64: small, fast and identical everywhere, unlike std:: distributions
+struct random {
+    uint64_t state;
+
+    uint64_t next(){
+        uint64_t z = ( state += 0x9e3779b97f4a7c15 );
+        z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9;
+        z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111eb;
+        return z ^ ( z >> 31 );
+    }
+
+    size_t below( size_t n ){
+        return n ? next() % n : 0;
+    }
+};
+
+class generator {
+    const corpus_shape& shape;
+    random rng;
+    std::string out;
+    size_t function = 0;
+
+    std::string variable( size_t v ) const {
+        return "f" + std::to_string( function ) + "v" + std::to_string( v );
+    }
+
+    std::string leaf(){
+        switch( rng.below( 3 ) ){
+            case 0:
+                return std::to_string( rng.below( 100000 ) );
+            case 1:
+                return rng.below( 2 ) ? "a" : "b";
+            default:
+                return shape.identifiers ? variable( rng.below( shape.identifiers ) )
+                                         : std::to_string( rng.below( 100 ) );
+        }
+    }
+
+    std::string expression( size_t depth ){
+        if( depth == 0 || rng.below( 4 ) == 0 ){
+            return leaf();
+        }
+        static const char* ops[] = { "+", "-", "*", "/" };
+        size_t o = rng.below( 4 );
+        std::string left = expression( depth - 1 );
+        // a nonzero divisor, so that the programs also run
+        std::string right = o == 3 ? std::to_string( 1 + rng.below( 99 ) ) : expression( depth - 1 );
+        return "( " + left + " " + ops[ o ] + " " + right + " )";
+    }
+
+    void statement(){
+        std::string target = shape.identifiers ? variable( rng.below( shape.identifiers ) ) : "";
+        size_t kind = rng.below( 8 );
+        if( target.empty() ){
+            out += "    print \"s\\n\";\n";
+        } else if( kind == 0 && function > 0 ){
+            out += "    " + target + " = f" + std::to_string( rng.below( function ) ) + " ( "
+                 + expression( 1 ) + " , " + expression( 1 ) + " );\n";
+        } else if( kind == 1 ){
+            out += "    if ( " + target + " ) {\n        " + target + " = "
+                 + expression( shape.depth ) + ";\n    }\n";
+        } else if( kind == 2 ){
+            out += "    printn " + std::to_string( rng.below( 1000 ) ) + ";\n";
+        } else {
+            out += "    " + target + " = " + expression( shape.depth ) + ";\n";
+        }
+    }
+
+  public:
+    generator( const corpus_shape& shape ) : shape( shape ), rng{ shape.seed } {}
+
+    std::string run(){
+        for( function = 0; function < shape.functions; ++function ){
+            out += "int f" + std::to_string( function ) + " ( int a, int b )\n{\n";
+            for( size_t v = 0; v < shape.identifiers; ++v ){
+                out += "    int " + variable( v ) + " = " + std::to_string( rng.below( 1000 ) )
+                     + ";\n";
+            }
+            for( size_t s = 0; s < shape.statements; ++s ){
+                statement();
+            }
+            if( shape.literals && shape.identifiers ){
+                out += "    " + variable( 0 ) + " = " + variable( 0 );
+                for( size_t l = 0; l < shape.literals; ++l ){
+                    out += " + " + std::to_string( 100000000 + rng.below( 900000000 ) );
+                }
+                out += ";\n";
+            }
+            out += "    return " + expression( 1 ) + ";\n}\n\n";
+        }
+        out += "int main ()\n{\n";
+        if( shape.functions ){
+            out += "    int r = f" + std::to_string( shape.functions - 1 ) + " ( 1 , 2 );\n";
+        }
+        out += "    return 0;\n}\n";
+        return std::move( out );
+    }
+};
+
+}
+
+std::string generate_corpus( const corpus_shape& shape ){
+    return generator( shape ).run();
+}
+
+corpus_shape shape_for_size( corpus_shape shape, size_t bytes ){
+    shape.functions = 1;
+    size_t one = generate_corpus( shape ).size();
+    shape.functions = std::max< size_t >( 1, bytes / std::max< size_t >( 1, one ) );
+    return shape;
+}
+
+std::vector< std::string > corpus_words( const std::string& source ){
+    std::vector< std::string > words;
+    std::string word;
+    bool quoted = false;
+    for( char c : source ){
+        if( c == '"' ){
+            quoted = !quoted;
+        }
+        if( !quoted && std::isalnum( uint8_t( c ) ) ){
+            word += c;
+            continue;
+        }
+        if( !word.empty() && !std::isdigit( uint8_t( word.front() ) ) ){
+            words.push_back( word );
+        }
+        word.clear();
+    }
+    return words;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Synthetic .td programs for the benchmarks, the same for the same shape.
+ *
+ * Function k declares its own variables, so every function adds identifiers to
+ * the dictionary, and its statements assign expression trees over them, its
+ * arguments and literals, call earlier functions and branch on variables. The
+ * programs avoid what the parser cannot take yet: calls inside a larger
+ * expression and declarations inside an if.
+ */
+struct corpus_shape {
+    size_t functions = 100;
+    size_t statements = 8;      // per function, besides declarations and the return
+    size_t depth = 3;           // of each expression tree
+    size_t identifiers = 4;     // variables declared in each function
+    size_t literals = 0;        // in one long line per function, none for no such line
+    uint64_t seed = 1;
+};
+
+std::string generate_corpus( const corpus_shape& shape );
+
+// shape with as many functions as make about bytes of source
+corpus_shape shape_for_size( corpus_shape shape, size_t bytes );
+
+// the words of source that are identifiers, in order
+std::vector< std::string > corpus_words( const std::string& source );
@@ -0,0 +1,381 @@
+#include "elf.hpp"
+#include "parser.hpp"
+#include "dimcli/libs/dimcli/cli.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <sstream>
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Speed of the programs the compiler makes, rather than of the compiler.
+ *
+ * Every workload is compiled in process, written as an executable and run
+ * --runs times with its output thrown away. Per workload this reports the
+ * median wall time, the static instruction count of the program, and the
+ * instructions, branches and system calls it executed, counted in user space
+ * with perf_event_open. Counts the kernel does not give us, e.g. in a VM
+ * without a PMU or without tracefs for the system calls, show as "-".
+ *
+ * --save writes the results to a file and --baseline compares with such a
+ * file, so a backend change can be judged by what it does to these numbers.
+ */
+
+using clock_type = std::chrono::steady_clock;
+
+enum metric { Seconds, Static, Instructions, Branches, Syscalls, Metrics };
+
+static const char* const metric_names[ Metrics ] = {
+    "ms", "static", "instructions", "branches", "syscalls"
+};
+
+struct result {
+    std::optional< double > values[ Metrics ];     // seconds for Seconds
+    int status = 0;
+};
+
+// A counter of one event in one process, enabled when the process execs.
+class counter {
+    int fd = -1;
+
+  public:
+    counter( pid_t pid, uint32_t type, uint64_t config, bool kernel = false ){
+        perf_event_attr attr{};
+        attr.size = sizeof( attr );
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.enable_on_exec = 1;
+        attr.exclude_kernel = !kernel;
+        attr.exclude_hv = 1;
+        fd = int( syscall( SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC ) );
+    }
+
+    ~counter(){
+        if( fd >= 0 ){
+            close( fd );
+        }
+    }
+
+    counter( const counter& ) = delete;
+    counter& operator=( const counter& ) = delete;
+
+    std::optional< double > value() const {
+        uint64_t n;
+        if( fd < 0 || read( fd, &n, sizeof( n ) ) != sizeof( n ) ){
+            return std::nullopt;
+        }
+        return double( n );
+    }
+};
+
+// the tracepoint id of entering a system call, or nothing without tracefs
+static std::optional< uint64_t > syscall_tracepoint(){
+    for( const char* root : { "/sys/kernel/tracing", "/sys/kernel/debug/tracing" } ){
+        std::ifstream id( std::string( root ) + "/events/raw_syscalls/sys_enter/id" );
+        uint64_t n;
+        if( id >> n ){
+            return n;
+        }
+    }
+    return std::nullopt;
+}
+
+// runs path once with its output going to /dev/null
+static result run( const std::string& path ){
+    static const std::optional< uint64_t > tracepoint = syscall_tracepoint();
+
+    int ready[ 2 ];
+    if( pipe2( ready, O_CLOEXEC ) != 0 ){
+        throw std::runtime_error( "pipe failed" );
+    }
+    pid_t pid = fork();
+    if( pid < 0 ){
+        throw std::runtime_error( "fork failed" );
+    }
+    if( pid == 0 ){
+        // wait for the counters before exec, which enables them
+        char go;
+        close( ready[ 1 ] );
+        if( read( ready[ 0 ], &go, 1 ) != 1 ){
+            _exit( 126 );
+        }
+        int null = open( "/dev/null", O_WRONLY );
+        if( null < 0 || dup2( null, STDOUT_FILENO ) < 0 ){
+            _exit( 126 );
+        }
+        execl( path.c_str(), path.c_str(), nullptr );
+        _exit( 127 );
+    }
+    close( ready[ 0 ] );
+
+    counter instructions( pid, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS );
+    counter branches( pid, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS );
+    std::optional< counter > syscalls;
+    if( tracepoint ){
+        syscalls.emplace( pid, PERF_TYPE_TRACEPOINT, *tracepoint, true );
+    }
+
+    auto start = clock_type::now();
+    if( write( ready[ 1 ], "x", 1 ) != 1 ){
+        throw std::runtime_error( "could not start " + path );
+    }
+    close( ready[ 1 ] );
+    int status;
+    waitpid( pid, &status, 0 );
+
+    result r;
+    r.values[ Seconds ] = std::chrono::duration< double >( clock_type::now() - start ).count();
+    r.values[ Instructions ] = instructions.value();
+    r.values[ Branches ] = branches.value();
+    if( syscalls ){
+        r.values[ Syscalls ] = syscalls->value();
+    }
+    r.status = WIFEXITED( status ) ? WEXITSTATUS( status ) : 128 + WTERMSIG( status );
+    return r;
+}
+
+// a directory of our own for the executables, removed however we leave
+class scratch_dir {
+    std::filesystem::path dir;
+
+  public:
+    scratch_dir()
+        : dir( std::filesystem::temp_directory_path() / ( "tdc-bench-" + std::to_string( getpid() ) ) )
+    {
+        std::filesystem::create_directories( dir );
+    }
+
+    ~scratch_dir(){
+        std::error_code ec;
+        std::filesystem::remove_all( dir, ec );
+    }
+
+    scratch_dir( const scratch_dir& ) = delete;
+    scratch_dir& operator=( const scratch_dir& ) = delete;
+
+    const std::filesystem::path& path() const { return dir; }
+};
+
+static std::optional< double > median( std::vector< double > v ){
+    if( v.empty() ){
+        return std::nullopt;
+    }
+    std::sort( v.begin(), v.end() );
+    return v[ v.size() / 2 ];
+}
+
+static result measure( const std::string& path, size_t runs ){
+    std::vector< double > samples[ Metrics ];
+    result r;
+    for( size_t i = 0; i < runs; ++i ){
+        result once = run( path );
+        for( int m = 0; m < Metrics; ++m ){
+            if( once.values[ m ] ){
+                samples[ m ].push_back( *once.values[ m ] );
+            }
+        }
+        r.status = once.status;
+    }
+    for( int m = 0; m < Metrics; ++m ){
+        // a count missing from some runs is not comparable
+        if( samples[ m ].size() == runs ){
+            r.values[ m ] = median( samples[ m ] );
+        }
+    }
+    return r;
+}
+
+static std::string format( metric m, const std::optional< double >& v ){
+    if( !v ){
+        return "-";
+    }
+    std::ostringstream out;
+    out << std::fixed << std::setprecision( m == Seconds ? 3 : 0 ) << ( m == Seconds ? *v * 1000 : *v );
+    return out.str();
+}
+
+/* Baselines are text: a line naming the options, then per workload its name,
+ * its exit status and every metric, "-" for a missing one.
+ */
+struct baseline {
+    std::string options;
+    std::map< std::string, result > results;
+};
+
+static void save( const std::string& path, const std::string& options,
+                  const std::vector< std::pair< std::string, result > >& results )
+{
+    std::ofstream out( path );
+    out << "options " << options << '\n';
+    for( auto& [ name, r ] : results ){
+        out << name << ' ' << r.status;
+        for( int m = 0; m < Metrics; ++m ){
+            out << ' ' << format( metric( m ), r.values[ m ] );
+        }
+        out << '\n';
+    }
+    if( !out ){
+        throw std::runtime_error( "could not write " + path );
+    }
+}
+
+static baseline load( const std::string& path ){
+    std::ifstream in( path );
+    baseline b;
+    std::string line;
+    if( !in || !std::getline( in, line ) || line.rfind( "options ", 0 ) != 0 ){
+        throw std::runtime_error( path + " is not a baseline" );
+    }
+    b.options = line.substr( 8 );
+    while( std::getline( in, line ) ){
+        std::istringstream fields( line );
+        std::string name;
+        result r;
+        if( !( fields >> name >> r.status ) ){
+            continue;
+        }
+        for( int m = 0; m < Metrics; ++m ){
+            std::string word;
+            fields >> word;
+            if( !word.empty() && word != "-" ){
+                r.values[ m ] = std::stod( word ) / ( m == Seconds ? 1000 : 1 );
+            }
+        }
+        b.results[ name ] = r;
+    }
+    return b;
+}
+
+static std::string change( const std::optional< double >& now, const std::optional< double >& then ){
+    if( !now || !then || *then == 0 ){
+        return "";
+    }
+    std::ostringstream out;
+    out << std::showpos << std::fixed << std::setprecision( 1 ) << ( *now / *then - 1 ) * 100 << '%';
+    return " (" + out.str() + ")";
+}
+
+static void print( const std::vector< std::pair< std::string, result > >& results,
+                   const std::optional< baseline >& before )
+{
+    int width = before ? 24 : 14;
+    std::cout << std::left << std::setw( 16 ) << "workload" << std::right;
+    for( auto name : metric_names ){
+        std::cout << std::setw( width ) << name;
+    }
+    std::cout << std::setw( 8 ) << "status" << '\n';
+
+    for( auto& [ name, r ] : results ){
+        const result* then = nullptr;
+        if( before ){
+            auto found = before->results.find( name );
+            then = found == before->results.end() ? nullptr : &found->second;
+        }
+        std::cout << std::left << std::setw( 16 ) << name << std::right;
+        for( int m = 0; m < Metrics; ++m ){
+            std::string cell = format( metric( m ), r.values[ m ] );
+            if( then ){
+                cell += change( r.values[ m ], then->values[ m ] );
+            }
+            std::cout << std::setw( width ) << cell;
+        }
+        std::cout << std::setw( 8 ) << r.status;
+        if( then && then->status != r.status ){
+            std::cout << " (was " << then->status << ')';
+        }
+        std::cout << '\n';
+    }
+}
+
+int main( int argc, char** argv ){
+    Dim::Cli cli;
+
+    auto& workloads = cli.optVec< std::string >( "[workload]" )
+        .desc( ".td programs to measure; without any, the examples" );
+
+    std::string examples;
+    cli.opt( &examples, "examples", "examples" ).desc( "directory holding the example workloads" );
+
+    size_t runs;
+    cli.opt( &runs, "runs", 5 ).desc( "times to run each program" );
+
+    std::string save_to;
+    cli.opt( &save_to, "save", "" ).desc( "write the results to this file as a baseline" );
+
+    std::string compare_with;
+    cli.opt( &compare_with, "baseline", "" ).desc( "show changes against a saved baseline" );
+
+    options opts;
+    cli.opt( &opts.optimize, "O optimize", false ).desc( "run the peephole optimizer" );
+    cli.opt( &opts.target, "t target", "i386" ).desc( "i386 or x86-64" );
+
+    if (!cli.parse(argc, argv))
+        return cli.printError( std::cerr );
+
+    std::vector< std::string > paths( workloads->begin(), workloads->end() );
+    if( paths.empty() ){
+        for( auto name : { "factorial", "printer", "arith", "calls", "branches" } ){
+            paths.push_back( examples + "/" + name + ".td" );
+        }
+    }
+    runs = std::max< size_t >( runs, 1 );
+    std::string settings = "-t " + opts.target + ( opts.optimize ? " -O" : "" );
+
+    try {
+        std::optional< baseline > before;
+        if( !compare_with.empty() ){
+            before = load( compare_with );
+            if( before->options != settings ){
+                std::cerr << "baseline was made with " << before->options << ", not " << settings
+                          << '\n';
+            }
+        }
+
+        scratch_dir dir;
+
+        std::vector< std::pair< std::string, result > > results;
+        for( auto& path : paths ){
+            std::string name = std::filesystem::path( path ).filename().string();
+            program compiled;
+            try {
+                parser p( opts );
+                p.parse( path );
+                compiled = p.compile();
+            } catch( std::invalid_argument& e ){
+                std::cerr << path << " does not compile\n";
+                return 1;
+            } catch( std::exception& e ){
+                std::cerr << path << " does not compile: " << e.what() << '\n';
+                return 1;
+            }
+            // numbered, as workloads from different directories may share a name
+            std::string exe = ( dir.path() / ( std::to_string( results.size() ) + "-"
+                              + std::filesystem::path( path ).stem().string() ) ).string();
+            write_executable( compiled, exe );
+
+            result r = measure( exe, runs );
+            r.values[ Static ] = double( std::count_if( compiled.text.begin(), compiled.text.end(),
+                [ & ]( const instruction& i ){ return i.op != Opcode::Label; } ) );
+            results.emplace_back( name, r );
+        }
+
+        print( results, before );
+        if( !save_to.empty() ){
+            save( save_to, settings, results );
+        }
+    } catch( std::exception& e ){
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+}
@@ -0,0 +1,264 @@
+#include "cache.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <thread>
+
+#include <unistd.h>
+
+// bump whenever code generation changes, so older entries stop matching
+static const char magic[ 8 ] = { 'T', 'D', 'C', 'O', 'D', 'E', '2', '\0' };
+
+static const std::string string_label = "__str";
+
+static void put( std::string& out, uint64_t value, int bytes ){
+    for( int b = 0; b < bytes; ++b ){
+        out += char( value >> ( 8 * b ) );
+    }
+}
+
+static void put( std::string& out, const std::string& text ){
+    put( out, text.size(), 4 );
+    out += text;
+}
+
+// reads in from at onwards; ok turns false once that runs past its end
+struct reader {
+    const std::string& in;
+    size_t at = 0;
+    bool ok = true;
+
+    uint64_t get( int bytes ){
+        if( at + bytes > in.size() ){
+            ok = false;
+            return 0;
+        }
+        uint64_t value = 0;
+        for( int b = 0; b < bytes; ++b ){
+            value |= uint64_t( uint8_t( in[ at++ ] ) ) << ( 8 * b );
+        }
+        return value;
+    }
+
+    std::string text(){
+        size_t size = get( 4 );
+        if( !ok || at + size > in.size() ){
+            ok = false;
+            return "";
+        }
+        at += size;
+        return in.substr( at - size, size );
+    }
+};
+
+static void put( std::string& out, const function& f ){
+    put( out, f.name );
+    put( out, uint64_t( f.type ), 1 );
+    put( out, f.arguments.size(), 4 );
+    for( Types t : f.arguments ){
+        put( out, uint64_t( t ), 1 );
+    }
+}
+
+code_cache::code_cache( std::string directory ) : directory( std::move( directory ) ) {}
+
+std::string code_cache::key_of( const std::vector< triple >& ts,
+                                const std::vector< function >& functions,
+                                const std::vector< int64_t >& integers,
+                                const std::vector< std::string >& strings,
+                                key f, const std::string& flags,
+                                std::vector< key >& used_strings )
+{
+    std::string result( magic, sizeof( magic ) );
+    put( result, flags );
+    put( result, functions[ f ] );
+    put( result, functions[ f ].variables.size(), 4 );
+    for( Types t : functions[ f ].variables ){
+        put( result, uint64_t( t ), 1 );
+    }
+
+    used_strings.clear();
+    put( result, ts.size(), 4 );
+    for( auto& t : ts ){
+        put( result, uint64_t( t.keyword ), 1 );
+        put( result, uint64_t( t.op ), 1 );
+        put( result, t.reused, 1 );
+        put( result, t.args.size(), 4 );
+        for( auto [ token, k ] : t.args ){
+            put( result, uint64_t( token ), 1 );
+            switch( token ){
+                case Token::Literal:
+                    put( result, integers[ k ], 8 );
+                    break;
+                case Token::String: {
+                    size_t at = std::find( used_strings.begin(), used_strings.end(), k )
+                              - used_strings.begin();
+                    if( at == used_strings.size() ){
+                        used_strings.push_back( k );
+                        put( result, strings[ k ] );
+                    }
+                    put( result, at, 4 );
+                    break;
+                }
+                case Token::Function:
+                    put( result, functions[ k ] );
+                    break;
+                default:
+                    put( result, k, 8 );
+            }
+        }
+    }
+    return result;
+}
+
+std::string code_cache::path( const std::string& id ) const {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+    for( char c : id ){
+        hash = ( hash ^ uint8_t( c ) ) * 0x100000001b3;
+    }
+    static const char digits[] = "0123456789abcdef";
+    std::string name;
+    for( int shift = 60; shift >= 0; shift -= 4 ){
+        name += digits[ ( hash >> shift ) & 15 ];
+    }
+    return ( std::filesystem::path( directory ) / name ).string();
+}
+
+// renames the label of strings[ used[ i ] ] to __str@i, or back when local is false
+static void rename_strings( std::vector< instruction >& code, const std::vector< key >& used,
+                            bool local )
+{
+    std::map< std::string, std::string > names;
+    for( size_t i = 0; i < used.size(); ++i ){
+        std::string global = string_label + std::to_string( used[ i ] );
+        std::string ours = string_label + "@" + std::to_string( i );
+        if( local ){
+            names[ global ] = ours;
+        } else {
+            names[ ours ] = global;
+        }
+    }
+    for( auto& i : code ){
+        for( auto& o : i.operands ){
+            auto name = names.find( o.symbol );
+            if( name != names.end() ){
+                o.symbol = name->second;
+            }
+        }
+    }
+}
+
+// whether i, as read from an entry, is something the encoder and printer handle
+static bool decodable( const instruction& i ){
+    using enum Opcode;
+    if( i.op > Syscall ){
+        return false;
+    }
+    // fewest and most operands of each opcode, in declaration order
+    static const std::pair< size_t, size_t > arity[] = {
+        { 1, 1 }, { 2, 2 }, { 2, 2 }, { 2, 2 }, { 1, 1 }, { 1, 1 }, { 2, 2 }, { 2, 2 },
+        { 2, 3 }, { 1, 1 }, { 1, 1 }, { 2, 2 }, { 2, 2 }, { 2, 2 }, { 2, 2 }, { 1, 1 },
+        { 1, 1 }, { 1, 1 }, { 1, 1 }, { 1, 1 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 1, 1 },
+        { 0, 0 }
+    };
+    static_assert( std::size( arity ) == size_t( Syscall ) + 1 );
+    auto [ fewest, most ] = arity[ size_t( i.op ) ];
+    if( i.operands.size() < fewest || i.operands.size() > most ){
+        return false;
+    }
+    for( auto& o : i.operands ){
+        if( o.kind > operand::Kind::Symbol || o.reg > Reg::None || o.index > Reg::None
+         || ( o.scale != 1 && o.scale != 2 && o.scale != 4 && o.scale != 8 ) )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::optional< std::vector< instruction > > code_cache::load( const std::string& id,
+                                                              const std::vector< key >& used_strings ) const
+{
+    std::ifstream file( path( id ), std::ios::binary );
+    if( !file ){
+        return std::nullopt;
+    }
+    std::string data( ( std::istreambuf_iterator< char >( file ) ),
+                      std::istreambuf_iterator< char >() );
+
+    reader in{ data };
+    if( in.text() != id ){
+        return std::nullopt;
+    }
+    size_t count = in.get( 4 );
+    if( count > data.size() ){
+        return std::nullopt;
+    }
+    std::vector< instruction > code( count );
+    for( auto& i : code ){
+        i.op = Opcode( in.get( 1 ) );
+        i.operands.resize( in.get( 1 ) );
+        for( auto& o : i.operands ){
+            o.kind = operand::Kind( in.get( 1 ) );
+            o.reg = Reg( in.get( 1 ) );
+            o.index = Reg( in.get( 1 ) );
+            o.scale = in.get( 1 );
+            o.value = int64_t( in.get( 8 ) );
+            o.symbol = in.text();
+        }
+        // a damaged entry is a miss, not code to trust
+        if( !in.ok || !decodable( i ) ){
+            return std::nullopt;
+        }
+    }
+    if( in.at != data.size() ){
+        return std::nullopt;
+    }
+    rename_strings( code, used_strings, false );
+    return code;
+}
+
+void code_cache::store( const std::string& id, const std::vector< key >& used_strings,
+                        std::vector< instruction > code ) const
+{
+    rename_strings( code, used_strings, true );
+
+    std::string data;
+    put( data, id );
+    put( data, code.size(), 4 );
+    for( auto& i : code ){
+        put( data, uint64_t( i.op ), 1 );
+        put( data, i.operands.size(), 1 );
+        for( auto& o : i.operands ){
+            put( data, uint64_t( o.kind ), 1 );
+            put( data, uint64_t( o.reg ), 1 );
+            put( data, uint64_t( o.index ), 1 );
+            put( data, o.scale, 1 );
+            put( data, o.value, 8 );
+            put( data, o.symbol );
+        }
+    }
+
+    // written aside and renamed into place, so readers never see half an entry
+    std::error_code ec;
+    std::filesystem::create_directories( directory, ec );
+    std::string target = path( id );
+    std::string temporary = target + ".tmp" + std::to_string( getpid() ) + "."
+                          + std::to_string( std::hash< std::thread::id >()( std::this_thread::get_id() ) );
+    {
+        std::ofstream file( temporary, std::ios::binary | std::ios::trunc );
+        if( !( file << data ) ){
+            std::filesystem::remove( temporary, ec );
+            return;
+        }
+    }
+    std::filesystem::rename( temporary, target, ec );
+    if( ec ){
+        std::filesystem::remove( temporary, ec );
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "instruction.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+/* Generated function bodies kept on disk between builds.
+ *
+ * An entry is found by a hash of its key, which spells out everything the
+ * body was generated from: the function's triples with their literals and
+ * strings written out, its own function entry and those of the functions it
+ * calls, and the flags. Strings are numbered in the order the function uses
+ * them, so adding one elsewhere in the module does not change the key; load
+ * and store rename the __strK labels between that numbering and the module's.
+ * The key is stored with the body and compared on load, so a hash collision
+ * is a miss.
+ */
+class code_cache {
+  public:
+    explicit code_cache( std::string directory );
+
+    // the key of function f, whose strings are listed in the order it uses them
+    static std::string key_of( const std::vector< triple >& ts,
+                               const std::vector< function >& functions,
+                               const std::vector< int64_t >& integers,
+                               const std::vector< std::string >& strings,
+                               key f, const std::string& flags,
+                               std::vector< key >& used_strings );
+
+    std::optional< std::vector< instruction > > load( const std::string& id,
+                                                      const std::vector< key >& used_strings ) const;
+
+    // failures to write are ignored, the entry is simply missing next time
+    void store( const std::string& id, const std::vector< key >& used_strings,
+                std::vector< instruction > code ) const;
+
+  private:
+    std::string directory;
+
+    std::string path( const std::string& id ) const;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <iostream>
+
+/* Where errors and warnings are written: std::cerr, unless the calling thread
+ * collects them elsewhere, as batch compilation does for each of its files.
+ */
+inline std::ostream*& diagnostics_stream(){
+    thread_local std::ostream* stream = &std::cerr;
+    return stream;
+}
+
+inline std::ostream& diagnostics(){
+    return *diagnostics_stream();
+}
+
+// Sends the calling thread's diagnostics to out while in scope.
+class collect_diagnostics {
+    std::ostream* previous;
+
+  public:
+    explicit collect_diagnostics( std::ostream& out ) : previous( diagnostics_stream() ) {
+        diagnostics_stream() = &out;
+    }
+    ~collect_diagnostics(){
+        diagnostics_stream() = previous;
+    }
+
+    collect_diagnostics( const collect_diagnostics& ) = delete;
+    collect_diagnostics& operator=( const collect_diagnostics& ) = delete;
+};
@@ -0,0 +1,118 @@
+#include "elf.hpp"
+#include "assembler.hpp"
+
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <map>
+
+static constexpr uint64_t page = 0x1000;
+
+static uint64_t align( uint64_t value, uint64_t to ){
+    return ( value + to - 1 ) / to * to;
+}
+
+static void put( std::string& out, uint64_t value, int64_t bytes ){
+    for( int64_t b = 0; b < bytes; ++b ){
+        out += char( value >> ( 8 * b ) );
+    }
+}
+
+std::string executable( const program& p ){
+    bool wide = p.word == 8;
+    uint64_t base = wide ? 0x400000 : 0x08048000;
+    uint64_t ehsize = wide ? 64 : 52;
+    uint64_t phentsize = wide ? 56 : 32;
+    uint64_t headers = ehsize + 2 * phentsize;
+
+    assembler code( p.word );
+    code.encode( p.text );
+
+    std::map< std::string, uint64_t > symbols;
+    uint64_t at = base + headers + code.size();
+    for( auto& block : p.rodata ){
+        symbols[ block.name ] = at;
+        at += block.bytes.size();
+    }
+    uint64_t file_size = at - base;
+
+    uint64_t bss = align( at, page );
+    at = bss;
+    for( auto& block : p.bss ){
+        at = align( at, p.word );
+        symbols[ block.name ] = at;
+        at += block.size;
+    }
+    uint64_t bss_size = at - bss;
+
+    code.link( base + headers, symbols );
+
+    std::string out;
+    auto word = [ & ]( uint64_t value ){ put( out, value, p.word ); };
+
+    out += "\x7f" "ELF";
+    out += char( wide ? 2 : 1 );                    // ELFCLASS64, ELFCLASS32
+    out += char( 1 );                               // little endian
+    out += char( 1 );                               // EV_CURRENT
+    out.resize( 16, '\0' );
+    put( out, 2, 2 );                               // ET_EXEC
+    put( out, wide ? 62 : 3, 2 );                   // EM_X86_64, EM_386
+    put( out, 1, 4 );                               // EV_CURRENT
+    word( base + headers + code.offset( "_start" ) );
+    word( ehsize );                                 // program headers
+    word( 0 );                                      // no section headers
+    put( out, 0, 4 );                               // flags
+    put( out, ehsize, 2 );
+    put( out, phentsize, 2 );
+    put( out, 2, 2 );
+    put( out, 0, 6 );                               // section header size, count, names
+
+    // PT_LOAD; the flags move in front of the offset in ELF64
+    auto segment = [ & ]( uint64_t offset, uint64_t address, uint64_t file,
+                          uint64_t memory, uint32_t flags ){
+        put( out, 1, 4 );
+        if( wide ){
+            put( out, flags, 4 );
+        }
+        word( offset );
+        word( address );
+        word( address );
+        word( file );
+        word( memory );
+        if( !wide ){
+            put( out, flags, 4 );
+        }
+        word( page );
+    };
+    segment( 0, base, file_size, file_size, 4 | 1 );        // PF_R | PF_X
+    segment( bss - base, bss, 0, bss_size, 4 | 2 );         // PF_R | PF_W
+
+    out += code.bytes();
+    for( auto& block : p.rodata ){
+        out += block.bytes;
+    }
+
+    return out;
+}
+
+void write_executable( const program& p, const std::string& path ){
+    write_executable( executable( p ), path );
+}
+
+void write_file( const std::string& data, const std::string& path ){
+    errno = 0;
+    std::ofstream file( path, std::ios::binary | std::ios::trunc );
+    file.write( data.data(), data.size() );
+    file.close();
+    if( !file ){
+        throw std::filesystem::filesystem_error( "could not write", path,
+            std::error_code( errno ? errno : EIO, std::generic_category() ) );
+    }
+}
+
+void write_executable( const std::string& image, const std::string& path ){
+    write_file( image, path );
+    using std::filesystem::perms;
+    std::filesystem::permissions( path, perms::owner_all | perms::group_read | perms::group_exec
+                                        | perms::others_read | perms::others_exec );
+}
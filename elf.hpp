@@ -0,0 +1,20 @@
+#pragma once
+
+#include "instruction.hpp"
+
+#include <string>
+
+/* p as a static ELF executable, ELF32 for i386 and ELF64 for x86-64.
+ *
+ * The file is mapped as one read-only, executable segment holding the headers,
+ * the code and .rodata; .bss is a second, zero-filled writable segment on the
+ * following page. No section headers or symbols are written, like ld -s.
+ */
+std::string executable( const program& p );
+
+// data written to path; throws std::filesystem::filesystem_error if it could not be
+void write_file( const std::string& data, const std::string& path );
+
+// executable( p ), written to path and made executable
+void write_executable( const program& p, const std::string& path );
+void write_executable( const std::string& image, const std::string& path );
@@ -0,0 +1,278 @@
+#include "instruction.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <string_view>
+#include <unordered_set>
+
+operand operand::r( Reg reg ){
+    operand o;
+    o.kind = Kind::Register;
+    o.reg = reg;
+    return o;
+}
+
+operand operand::imm( int64_t value ){
+    operand o;
+    o.kind = Kind::Immediate;
+    o.value = value;
+    return o;
+}
+
+operand operand::imm( std::string symbol ){
+    operand o;
+    o.kind = Kind::Immediate;
+    o.symbol = std::move( symbol );
+    return o;
+}
+
+operand operand::mem( Reg base, int64_t disp ){
+    operand o;
+    o.kind = Kind::Memory;
+    o.reg = base;
+    o.value = disp;
+    return o;
+}
+
+operand operand::mem( Reg base, int64_t disp, Reg index, int64_t scale ){
+    operand o = mem( base, disp );
+    o.index = index;
+    o.scale = scale;
+    return o;
+}
+
+operand operand::mem( std::string symbol, Reg base ){
+    operand o = mem( base, 0 );
+    o.symbol = std::move( symbol );
+    return o;
+}
+
+operand operand::sym( std::string symbol ){
+    operand o;
+    o.kind = Kind::Symbol;
+    o.symbol = std::move( symbol );
+    return o;
+}
+
+instruction label( std::string name ){
+    return { Opcode::Label, { operand::sym( std::move( name ) ) } };
+}
+
+static const char* mnemonic( Opcode op ){
+    using enum Opcode;
+    switch( op ){
+        case Mov:  return "mov";
+        case Movb: return "movb";
+        case Lea:  return "lea";
+        case Push: return "push";
+        case Pop:  return "pop";
+        case Add:  return "add";
+        case Sub:  return "sub";
+        case Imul: return "imul";
+        case Div:  return "div";
+        case Neg:  return "neg";
+        case Shr:  return "shr";
+        case Xor:  return "xor";
+        case Cmp:  return "cmp";
+        case Test: return "test";
+        case Je:   return "je";
+        case Jne:  return "jne";
+        case Jae:  return "jae";
+        case Jmp:  return "jmp";
+        case Call: return "call";
+        case Ret:  return "ret";
+        case Leave: return "leave";
+        case RepMovsb: return "rep movsb";
+        case Int:  return "int";
+        case Syscall: return "syscall";
+        default:   return "";
+    }
+}
+
+static const char* reg_name( Reg reg, int64_t word ){
+    static const char* names[] = { "%eax", "%ecx", "%edx", "%ebx",
+                                   "%esp", "%ebp", "%esi", "%edi",
+                                   "%r8d", "%r9d", "%r10d", "%r11d",
+                                   "%r12d", "%r13d", "%r14d", "%r15d" };
+    static const char* wide[] = { "%rax", "%rcx", "%rdx", "%rbx",
+                                  "%rsp", "%rbp", "%rsi", "%rdi",
+                                  "%r8", "%r9", "%r10", "%r11",
+                                  "%r12", "%r13", "%r14", "%r15" };
+    if( reg == Reg::None ){
+        return "";
+    }
+    return word == 8 ? wide[ size_t( reg ) ] : names[ size_t( reg ) ];
+}
+
+static void append( std::string& out, int64_t value ){
+    char digits[ 24 ];
+    out.append( digits, std::to_chars( digits, digits + sizeof( digits ), value ).ptr );
+}
+
+static void append_address( std::string& out, const operand& o ){
+    out += o.symbol;
+    if( o.symbol.empty() || o.value ){
+        if( !o.symbol.empty() && o.value > 0 ){
+            out += '+';
+        }
+        append( out, o.value );
+    }
+}
+
+static const char* byte_name( Reg reg ){
+    static const char* names[] = { "%al", "%cl", "%dl", "%bl" };
+    return reg < Reg::Sp ? names[ size_t( reg ) ] : "";
+}
+
+static void append( std::string& out, const operand& o, int64_t word ){
+    using enum operand::Kind;
+    switch( o.kind ){
+        case Register:
+            out += word == 1 ? byte_name( o.reg ) : reg_name( o.reg, word );
+            break;
+        case Immediate:
+            out += '$';
+            append_address( out, o );
+            break;
+        case Memory:
+            append_address( out, o );
+            if( o.reg != Reg::None || o.index != Reg::None ){
+                out += '(';
+                out += reg_name( o.reg, word );
+                if( o.index != Reg::None ){
+                    out += ',';
+                    out += reg_name( o.index, word );
+                    out += ',';
+                    append( out, o.scale );
+                }
+                out += ')';
+            }
+            break;
+        case Symbol:
+            out += o.symbol;
+            break;
+        default:
+            break;
+    }
+}
+
+static void append( std::string& out, const instruction& i, int64_t word ){
+    if( i.op == Opcode::Label ){
+        append( out, i.operands.front(), word );
+        out += ":\n";
+        return;
+    }
+
+    // Without a register operand the assembler cannot infer the operand size.
+    bool has_reg = std::any_of( i.operands.begin(), i.operands.end(),
+                                []( auto& o ){ return o.kind == operand::Kind::Register; } );
+    bool has_mem = std::any_of( i.operands.begin(), i.operands.end(),
+                                []( auto& o ){ return o.kind == operand::Kind::Memory; } );
+
+    out += "  ";
+    out += mnemonic( i.op );
+    if( has_mem && !has_reg ){
+        out += word == 8 ? 'q' : 'l';
+    }
+    for( size_t n = 0; n < i.operands.size(); ++n ){
+        out += n == 0 ? " " : ", ";
+        // the stored register of movb is a byte register, its address is not
+        bool byte = i.op == Opcode::Movb && n == 0;
+        append( out, i.operands[ n ], byte ? 1 : word );
+    }
+    out += '\n';
+}
+
+std::string to_string( const operand& o, int64_t word ){
+    std::string result;
+    append( result, o, word );
+    return result;
+}
+
+std::string to_string( const instruction& i, int64_t word ){
+    std::string result;
+    append( result, i, word );
+    return result;
+}
+
+std::string to_string( const std::vector< instruction >& code, int64_t word ){
+    std::string result;
+    for( auto& i : code ){
+        append( result, i, word );
+    }
+    return result;
+}
+
+static void append_quoted( std::string& out, const std::string& bytes ){
+    out += '"';
+    for( unsigned char c : bytes ){
+        if( c == '"' || c == '\\' ){
+            out += '\\';
+            out += c;
+        } else if( c < ' ' || c > '~' ){
+            out += '\\';
+            out += char( '0' + ( c >> 6 ) );
+            out += char( '0' + ( ( c >> 3 ) & 7 ) );
+            out += char( '0' + ( c & 7 ) );
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+static void append( std::string& out, const std::vector< data_block >& data ){
+    for( auto& block : data ){
+        out += block.name;
+        out += ":\n";
+        if( block.bytes.empty() ){
+            out += "  .skip ";
+            append( out, int64_t( block.size ) );
+        } else {
+            out += "  .ascii ";
+            append_quoted( out, block.bytes );
+        }
+        out += '\n';
+    }
+}
+
+std::string to_string( const std::vector< data_block >& data ){
+    std::string result;
+    append( result, data );
+    return result;
+}
+
+void append( std::string& out, const program& p ){
+    // roughly what an instruction takes, to grow out once
+    out.reserve( out.size() + 24 * p.text.size() + 32 * p.globals.size() );
+
+    std::unordered_set< std::string_view > globals;
+    out += ".text\n";
+    for( auto& name : p.globals ){
+        out += "    .global ";
+        out += name;
+        out += '\n';
+        globals.insert( name );
+    }
+    for( auto& i : p.text ){
+        // a blank line before every function
+        if( i.op == Opcode::Label && globals.count( i.operands.front().symbol ) ){
+            out += '\n';
+        }
+        append( out, i, p.word );
+    }
+    if( !p.rodata.empty() ){
+        out += "\n.section .rodata\n";
+        append( out, p.rodata );
+    }
+    if( !p.bss.empty() ){
+        out += ".bss\n";
+        append( out, p.bss );
+    }
+}
+
+std::string to_string( const program& p ){
+    std::string result;
+    append( result, p );
+    return result;
+}
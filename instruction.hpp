@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class Opcode {
+    Label,
+    Mov,
+    Movb,
+    Lea,
+    Push,
+    Pop,
+    Add,
+    Sub,
+    Imul,
+    Div,
+    Neg,
+    Shr,
+    Xor,
+    Cmp,
+    Test,
+    Je,
+    Jne,
+    Jae,
+    Jmp,
+    Call,
+    Ret,
+    Leave,
+    RepMovsb,
+    Int,
+    Syscall
+};
+
+// Listed in hardware encoding order.
+enum class Reg {
+    Ax,
+    Cx,
+    Dx,
+    Bx,
+    Sp,
+    Bp,
+    Si,
+    Di,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15,
+    None
+};
+
+struct operand {
+    enum class Kind {
+        None,
+        Register,
+        Immediate,
+        Memory,
+        Symbol
+    };
+
+    Kind kind = Kind::None;
+    Reg reg = Reg::None;    // the register, or the base of a memory operand
+    Reg index = Reg::None;
+    int64_t scale = 1;
+    int64_t value = 0;      // the immediate, or the displacement of a memory operand
+    std::string symbol;     // a call or jump target, or an address added to value
+
+    static operand r( Reg reg );
+    static operand imm( int64_t value );
+    static operand imm( std::string symbol );
+    static operand mem( Reg base, int64_t disp = 0 );
+    static operand mem( Reg base, int64_t disp, Reg index, int64_t scale );
+    static operand mem( std::string symbol, Reg base = Reg::None );
+    static operand sym( std::string symbol );
+
+    bool is_reg( Reg r ) const { return kind == Kind::Register && reg == r; }
+    bool is_imm( int64_t v ) const { return kind == Kind::Immediate && value == v; }
+
+    bool operator==( const operand& ) const = default;
+};
+
+// Operands follow AT&T order: source first, destination last.
+struct instruction {
+    Opcode op = Opcode::Label;
+    std::vector< operand > operands;
+
+    instruction() = default;
+    instruction( Opcode op, std::vector< operand > operands = {} )
+        : op( op ), operands( std::move( operands ) ) {}
+
+    bool operator==( const instruction& ) const = default;
+};
+
+instruction label( std::string name );
+
+// A named block of static data; zero-initialised (.bss) when bytes is empty.
+struct data_block {
+    std::string name;
+    std::string bytes;
+    size_t size = 0;
+};
+
+// A translated program: _start, the runtime and every function, then its data.
+struct program {
+    int64_t word = 4;
+    std::vector< std::string > globals;
+    std::vector< instruction > text;
+    std::vector< data_block > rodata;
+    std::vector< data_block > bss;
+};
+
+// word selects the register names and operand size suffix: 4 or 8 bytes
+std::string to_string( const operand& o, int64_t word = 4 );
+std::string to_string( const instruction& i, int64_t word = 4 );
+std::string to_string( const std::vector< instruction >& code, int64_t word = 4 );
+std::string to_string( const std::vector< data_block >& data );
+std::string to_string( const program& p );
+// to_string( p ) added to the end of out, so one buffer can be reused
+void append( std::string& out, const program& p );
@@ -0,0 +1,420 @@
+#include "interpreter.hpp"
+#include "diagnostics.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <tuple>
+
+interpreter::interpreter( const std::map< key, std::vector< triple > >& triples,
+                          const std::vector< function >& functions,
+                          const std::vector< int64_t >& integers,
+                          const std::vector< std::string >& strings,
+                          int64_t word )
+    : triples( triples ), functions( functions ), integers( integers ), strings( strings ),
+      word( word )
+{
+    for( auto& [ f, ts ] : this->triples ){
+        decode( f );
+    }
+}
+
+void interpreter::decode( key f ){
+    if( f >= functions.size() ){
+        error( "code for function " + std::to_string( f ) + ", which is not declared" );
+    }
+    const std::vector< triple >& ts = triples[ f ];
+    // what would make flatten() or run() index past a table, e.g. from --from-ir
+    for( size_t t = 0; t < ts.size(); ++t ){
+        if( auto why = malformed( triples, f, t, functions, integers, strings ) ){
+            error( "in " + functions[ f ].name + ", statement " + std::to_string( t ) + " "
+                   + *why );
+        }
+    }
+    decoded& d = code[ f ];
+    d.arguments = functions[ f ].arguments.size();
+    d.hits.assign( ts.size(), 0 );
+    d.taken.assign( ts.size(), 0 );
+    declared = 0;
+    pending.clear();
+
+    std::vector< bool > used( ts.size(), false );
+    for( auto& t : ts ){
+        for( auto [ token, k ] : t.args ){
+            if( token == Token::Expression ){
+                used[ k ] = true;
+            }
+        }
+    }
+
+    for( size_t t = 0; t < ts.size(); ++t ){
+        if( used[ t ] ){
+            continue;
+        }
+        flatten( f, d, t );
+        // a call or arithmetic as a statement leaves its value behind
+        if( ts[ t ].keyword == Keywords::None && ts[ t ].op != Operators::Equals ){
+            d.ops.push_back( { Code::Drop, none, 0 } );
+        }
+    }
+
+    // falling off the end returns 0, and so do Ifjumps without a Label
+    for( size_t at : pending ){
+        d.ops[ at ].value = d.ops.size();
+    }
+    d.ops.push_back( { Code::Literal, none, 0 } );
+    d.ops.push_back( { Code::Return, none, 0 } );
+
+    d.slots = d.arguments + std::max( declared, functions[ f ].variables.size() );
+}
+
+void interpreter::flatten( key f, decoded& d, const std::pair< Token, key >& arg ){
+    auto [ token, k ] = arg;
+    switch( token ){
+        case Token::Literal:
+            d.ops.push_back( { Code::Literal, none, wrap( integers[ k ] ) } );
+            break;
+        case Token::Identifier:
+            d.ops.push_back( { Code::Load, none, int64_t( d.arguments + k ) } );
+            break;
+        case Token::Argument:
+            d.ops.push_back( { Code::Load, none, int64_t( k ) } );
+            break;
+        case Token::Expression: {
+            const triple& t = triples[ f ][ k ];
+            if( t.keyword != Keywords::None || t.op == Operators::Equals ){
+                error( "in " + functions[ f ].name + ", statement " + std::to_string( k )
+                       + " is used as a value" );
+            }
+            flatten( f, d, k );
+            break;
+        }
+        default:
+            error( "in " + functions[ f ].name + ", a "
+                   + ( token == Token::String ? "string" : "token" ) + " is used as a value" );
+    }
+}
+
+void interpreter::flatten( key f, decoded& d, size_t t ){
+    const triple& tr = triples[ f ][ t ];
+    auto& args = tr.args;
+    uint32_t self = uint32_t( t );
+
+    auto slot = [ & ]( const std::pair< Token, key >& target ){
+        if( target.first == Token::Argument ){
+            return int64_t( target.second );
+        }
+        if( target.first != Token::Identifier ){
+            error( "in " + functions[ f ].name + ", statement " + std::to_string( t )
+                   + " assigns to something that is not a variable" );
+        }
+        return int64_t( d.arguments + target.second );
+    };
+
+    switch( tr.keyword ){
+        case Keywords::Return:
+            if( args.empty() ){
+                d.ops.push_back( { Code::Literal, none, 0 } );
+            } else {
+                flatten( f, d, args[ 0 ] );
+            }
+            d.ops.push_back( { Code::Return, self, 0 } );
+            return;
+        case Keywords::Declaration:
+            if( args.empty() ){
+                d.ops.push_back( { Code::Literal, none, 0 } );
+            } else {
+                flatten( f, d, args[ 0 ] );
+            }
+            d.ops.push_back( { Code::Store, self, int64_t( d.arguments + declared++ ) } );
+            return;
+        case Keywords::Ifjump:
+            flatten( f, d, args[ 0 ] );
+            pending.push_back( d.ops.size() );
+            d.ops.push_back( { Code::Jump, self, 0 } );
+            return;
+        case Keywords::Print:
+            if( args[ 0 ].first == Token::String ){
+                d.ops.push_back( { Code::Text, self, int64_t( args[ 0 ].second ) } );
+            } else {
+                flatten( f, d, args[ 0 ] );
+                d.ops.push_back( { Code::Print, self, 0 } );
+            }
+            return;
+        case Keywords::Label:
+            // every Ifjump before it lands here, as in the generated code
+            for( size_t at : pending ){
+                d.ops[ at ].value = d.ops.size();
+            }
+            pending.clear();
+            return;
+        default:
+            break;
+    }
+
+    switch( tr.op ){
+        case Operators::Equals:
+            flatten( f, d, args[ 1 ] );
+            d.ops.push_back( { Code::Store, self, slot( args[ 0 ] ) } );
+            return;
+        case Operators::Call: {
+            key callee = args[ 0 ].second;
+            size_t arity = functions[ callee ].arguments.size();
+            std::vector< std::pair< Token, key > > actual;
+            for( size_t i = 1; i < args.size(); ++i ){
+                if( args[ i ].first != Token::None ){
+                    actual.push_back( args[ i ] );
+                }
+            }
+            // right to left; extra arguments are evaluated and dropped, missing ones are 0
+            for( size_t i = std::max( arity, actual.size() ); i > 0; --i ){
+                if( i - 1 < actual.size() ){
+                    flatten( f, d, actual[ i - 1 ] );
+                    if( i - 1 >= arity ){
+                        d.ops.push_back( { Code::Drop, none, 0 } );
+                    }
+                } else {
+                    d.ops.push_back( { Code::Literal, none, 0 } );
+                }
+            }
+            d.ops.push_back( { Code::Call, self, int64_t( callee ) } );
+            return;
+        }
+        case Operators::Intplus:
+        case Operators::Intmin:
+        case Operators::Intmul:
+        case Operators::Intdiv: {
+            flatten( f, d, args[ 0 ] );
+            flatten( f, d, args[ 1 ] );
+            Code c = tr.op == Operators::Intplus ? Code::Add
+                   : tr.op == Operators::Intmin ? Code::Sub
+                   : tr.op == Operators::Intmul ? Code::Mul : Code::Div;
+            d.ops.push_back( { c, self, 0 } );
+            return;
+        }
+        default:
+            error( "in " + functions[ f ].name + ", statement " + std::to_string( t )
+                   + " cannot be interpreted" );
+    }
+}
+
+int64_t interpreter::wrap( uint64_t value ) const {
+    return word == 8 ? int64_t( value ) : int64_t( int32_t( value ) );
+}
+
+int64_t interpreter::run( std::ostream& out ){
+    auto main = std::find_if( code.begin(), code.end(), [ & ]( auto& c ){
+        return functions[ c.first ].name == "main"; } );
+    if( main == code.end() ){
+        error( "there is no main function" );
+    }
+
+    struct frame {
+        decoded* d;
+        size_t pc;
+        size_t base;        // of the slots
+        size_t stack;       // height of the caller's stack
+    };
+
+    std::vector< int64_t > slots;
+    std::vector< int64_t > stack;
+    std::vector< frame > frames;
+    std::string buffer;
+    uint64_t mask = word == 8 ? ~uint64_t( 0 ) : 0xffffffff;
+
+    auto pop = [ & ]{
+        int64_t v = stack.back();
+        stack.pop_back();
+        return v;
+    };
+    // the arguments are on the stack, the first one on top
+    auto enter = [ & ]( decoded& d ){
+        ++d.calls;
+        size_t base = slots.size();
+        slots.resize( base + d.slots, 0 );
+        for( size_t a = 0; a < d.arguments; ++a ){
+            slots[ base + a ] = pop();
+        }
+        frames.push_back( { &d, 0, base, stack.size() } );
+    };
+
+    enter( main->second );
+    decoded* d = frames.back().d;
+    const op* ops = d->ops.data();
+    size_t pc = 0;
+    size_t base = 0;
+
+    for( ;; ){
+        const op& o = ops[ pc++ ];
+        if( o.triple != none ){
+            ++d->hits[ o.triple ];
+        }
+        switch( o.code ){
+            case Code::Literal:
+                stack.push_back( o.value );
+                break;
+            case Code::Load:
+                stack.push_back( slots[ base + o.value ] );
+                break;
+            case Code::Store:
+                slots[ base + o.value ] = pop();
+                break;
+            case Code::Add: {
+                int64_t b = pop();
+                stack.back() = wrap( uint64_t( stack.back() ) + uint64_t( b ) );
+                break;
+            }
+            case Code::Sub: {
+                int64_t b = pop();
+                stack.back() = wrap( uint64_t( stack.back() ) - uint64_t( b ) );
+                break;
+            }
+            case Code::Mul: {
+                int64_t b = pop();
+                stack.back() = wrap( uint64_t( stack.back() ) * uint64_t( b ) );
+                break;
+            }
+            case Code::Div: {
+                uint64_t b = uint64_t( pop() ) & mask;
+                if( b == 0 ){
+                    out << buffer;
+                    error( "division by zero" );
+                }
+                stack.back() = wrap( ( uint64_t( stack.back() ) & mask ) / b );
+                break;
+            }
+            case Code::Jump:
+                if( pop() == 0 ){
+                    ++d->taken[ o.triple ];
+                    pc = o.value;
+                }
+                break;
+            case Code::Print:
+                buffer += char( pop() );
+                break;
+            case Code::Text:
+                buffer += strings[ o.value ];
+                break;
+            case Code::Drop:
+                stack.pop_back();
+                break;
+            case Code::Call:
+                frames.back().pc = pc;
+                enter( code.at( o.value ) );
+                d = frames.back().d;
+                ops = d->ops.data();
+                pc = 0;
+                base = frames.back().base;
+                break;
+            case Code::Return: {
+                int64_t result = pop();
+                slots.resize( frames.back().base );
+                stack.resize( frames.back().stack );
+                frames.pop_back();
+                if( frames.empty() ){
+                    out << buffer;
+                    out.flush();
+                    return result;
+                }
+                stack.push_back( result );
+                d = frames.back().d;
+                ops = d->ops.data();
+                pc = frames.back().pc;
+                base = frames.back().base;
+                break;
+            }
+        }
+        if( buffer.size() >= 4096 ){
+            out << buffer;
+            buffer.clear();
+        }
+    }
+}
+
+std::pair< uint64_t, uint64_t > interpreter::branch( key f, size_t t ) const {
+    const decoded& d = code.at( f );
+    return { d.hits[ t ] - d.taken[ t ], d.taken[ t ] };
+}
+
+void interpreter::report( std::ostream& out, size_t top ) const {
+    std::vector< std::pair< uint64_t, key > > calls;
+    std::vector< std::tuple< uint64_t, key, size_t > > hot;
+    for( auto& [ f, d ] : code ){
+        calls.emplace_back( d.calls, f );
+        for( size_t t = 0; t < d.hits.size(); ++t ){
+            if( d.hits[ t ] ){
+                hot.emplace_back( d.hits[ t ], f, t );
+            }
+        }
+    }
+    std::stable_sort( calls.begin(), calls.end(), []( auto& a, auto& b ){
+        return a.first > b.first; } );
+    std::stable_sort( hot.begin(), hot.end(), []( auto& a, auto& b ){
+        return std::get< 0 >( a ) > std::get< 0 >( b ); } );
+
+    out << "calls:\n";
+    for( auto [ n, f ] : calls ){
+        out << std::setw( 12 ) << n << "  " << functions[ f ].name << '\n';
+    }
+
+    out << "hottest triples:\n";
+    for( size_t i = 0; i < hot.size() && i < top; ++i ){
+        auto [ n, f, t ] = hot[ i ];
+        out << std::setw( 12 ) << n << "  " << functions[ f ].name << " #" << t
+            << "  " << describe( f, t ) << '\n';
+    }
+
+    out << "branches (fell through / jumped):\n";
+    for( auto& [ f, ts ] : triples ){
+        for( size_t t = 0; t < ts.size(); ++t ){
+            if( ts[ t ].keyword == Keywords::Ifjump ){
+                auto [ through, jumped ] = branch( f, t );
+                out << std::setw( 12 ) << through << std::setw( 12 ) << jumped << "  "
+                    << functions[ f ].name << " #" << t << "  " << describe( f, t ) << '\n';
+            }
+        }
+    }
+}
+
+std::string interpreter::describe( key f, size_t t ) const {
+    const triple& tr = triples.at( f )[ t ];
+    std::string result;
+    switch( tr.keyword ){
+        case Keywords::Return:      result = "return"; break;
+        case Keywords::Declaration: result = "declare"; break;
+        case Keywords::Ifjump:      result = "if"; break;
+        case Keywords::Print:       result = "print"; break;
+        case Keywords::Label:       result = "label"; break;
+        default:
+            switch( tr.op ){
+                case Operators::Intplus: result = "+"; break;
+                case Operators::Intmin:  result = "-"; break;
+                case Operators::Intmul:  result = "*"; break;
+                case Operators::Intdiv:  result = "/"; break;
+                case Operators::Equals:  result = "="; break;
+                case Operators::Call:    result = "call"; break;
+                default:                 result = "?"; break;
+            }
+    }
+
+    std::string sep = " ";
+    for( auto [ token, k ] : tr.args ){
+        switch( token ){
+            case Token::Literal:    result += sep + std::to_string( integers[ k ] ); break;
+            case Token::Identifier: result += sep + "v" + std::to_string( k ); break;
+            case Token::Argument:   result += sep + "a" + std::to_string( k ); break;
+            case Token::Expression: result += sep + "#" + std::to_string( k ); break;
+            case Token::Function:   result += sep + functions[ k ].name; break;
+            case Token::String:     result += sep + "\"...\""; break;
+            default:                continue;
+        }
+        sep = ", ";
+    }
+    return result;
+}
+
+void interpreter::error( std::string str ) const {
+    diagnostics() << "Error in interpreter:\n  " << str << '\n';
+    throw std::invalid_argument( "interpreter" );
+}
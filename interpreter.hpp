@@ -0,0 +1,95 @@
+#pragma once
+
+#include "lexer.hpp"
+#include "parser.hpp"
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/* Executes the triples of parser::to_triples without generating code.
+ *
+ * Each function is decoded once into a flat array of stack operations, the
+ * expression trees of its statements in evaluation order, and run by a switch
+ * over that array. Arithmetic wraps at the target's word size and division is
+ * unsigned, as in the generated code; call arguments are evaluated right to
+ * left, as on i386.
+ *
+ * Every triple, call and Ifjump is counted while running; report() lists them
+ * hottest first.
+ */
+class interpreter {
+  public:
+    interpreter( const std::map< key, std::vector< triple > >& triples,
+                 const std::vector< function >& functions,
+                 const std::vector< int64_t >& integers,
+                 const std::vector< std::string >& strings,
+                 int64_t word );
+
+    // runs main, printing to out; returns what main returns
+    int64_t run( std::ostream& out );
+
+    void report( std::ostream& out, size_t top = 20 ) const;
+
+    uint64_t count( key f, size_t t ) const { return code.at( f ).hits[ t ]; }
+    uint64_t calls( key f ) const { return code.at( f ).calls; }
+    // times an Ifjump fell through into its block, and jumped over it
+    std::pair< uint64_t, uint64_t > branch( key f, size_t t ) const;
+
+  private:
+    enum class Code : uint8_t {
+        Literal,
+        Load,       // a variable or argument slot
+        Store,
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Call,
+        Return,
+        Jump,       // if zero, to value
+        Print,
+        Text,       // print strings[ value ]
+        Drop
+    };
+
+    struct op {
+        Code code;
+        uint32_t triple;    // the triple this op finishes, or none
+        int64_t value;
+    };
+
+    static constexpr uint32_t none = UINT32_MAX;
+
+    struct decoded {
+        std::vector< op > ops;
+        size_t slots = 0;       // arguments, then variables
+        size_t arguments = 0;
+
+        std::vector< uint64_t > hits;       // per triple
+        std::vector< uint64_t > taken;      // per triple, Ifjumps only
+        uint64_t calls = 0;
+    };
+
+    std::map< key, std::vector< triple > > triples;
+    const std::vector< function >& functions;
+    const std::vector< int64_t >& integers;
+    const std::vector< std::string >& strings;
+    int64_t word;
+
+    std::map< key, decoded > code;
+
+    // while decoding a function
+    size_t declared = 0;
+    std::vector< size_t > pending;      // Ifjumps waiting for the next Label
+
+    void decode( key f );
+    void flatten( key f, decoded& d, const std::pair< Token, key >& arg );
+    void flatten( key f, decoded& d, size_t t );
+    int64_t wrap( uint64_t value ) const;
+    std::string describe( key f, size_t t ) const;
+
+    [[noreturn]] void error( std::string str ) const;
+};
@@ -0,0 +1,273 @@
+#include "ir.hpp"
+#include "diagnostics.hpp"
+
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char magic[ 4 ] = { 'T', 'D', 'I', 'R' };
+static constexpr uint32_t version = 1;
+
+static constexpr size_t arrays = 7;
+static constexpr size_t header_size = 8 + arrays * 16;
+
+static constexpr size_t function_size = 32;
+static constexpr size_t type_size = 1;
+static constexpr size_t triple_size = 12;
+static constexpr size_t argument_size = 16;
+static constexpr size_t integer_size = 8;
+static constexpr size_t string_size = 8;
+static constexpr size_t text_size = 1;
+
+static void put( std::string& out, uint64_t value, int bytes ){
+    for( int b = 0; b < bytes; ++b ){
+        out += char( value >> ( 8 * b ) );
+    }
+}
+
+static void set( std::string& out, size_t at, uint64_t value, int bytes ){
+    for( int b = 0; b < bytes; ++b ){
+        out[ at + b ] = char( value >> ( 8 * b ) );
+    }
+}
+
+std::string encode_ir( const std::map< key, std::vector< triple > >& triples,
+                       const std::vector< function >& functions,
+                       const std::vector< int64_t >& integers,
+                       const std::vector< std::string >& strings )
+{
+    std::string function_records, types, triple_records, argument_records, integer_records,
+                string_records, text;
+
+    for( auto& s : strings ){
+        put( string_records, text.size(), 4 );
+        put( string_records, s.size(), 4 );
+        text += s;
+    }
+
+    uint64_t triple_count = 0;
+    uint64_t argument_count = 0;
+    for( size_t f = 0; f < functions.size(); ++f ){
+        auto body = triples.find( f );
+        size_t count = body == triples.end() ? 0 : body->second.size();
+
+        put( function_records, text.size(), 4 );
+        put( function_records, functions[ f ].name.size(), 4 );
+        text += functions[ f ].name;
+        put( function_records, uint64_t( functions[ f ].type ), 1 );
+        put( function_records, body != triples.end(), 1 );
+        put( function_records, 0, 2 );
+        put( function_records, types.size(), 4 );
+        put( function_records, functions[ f ].arguments.size(), 4 );
+        put( function_records, functions[ f ].variables.size(), 4 );
+        put( function_records, triple_count, 4 );
+        put( function_records, count, 4 );
+
+        for( Types t : functions[ f ].arguments ){
+            put( types, uint64_t( t ), 1 );
+        }
+        for( Types t : functions[ f ].variables ){
+            put( types, uint64_t( t ), 1 );
+        }
+
+        for( size_t t = 0; t < count; ++t ){
+            const triple& tr = body->second[ t ];
+            put( triple_records, uint64_t( tr.keyword ), 1 );
+            put( triple_records, uint64_t( tr.op ), 1 );
+            put( triple_records, tr.reused, 1 );
+            put( triple_records, 0, 1 );
+            put( triple_records, argument_count, 4 );
+            put( triple_records, tr.args.size(), 4 );
+            for( auto [ token, k ] : tr.args ){
+                put( argument_records, uint64_t( token ), 4 );
+                put( argument_records, 0, 4 );
+                put( argument_records, k, 8 );
+            }
+            argument_count += tr.args.size();
+        }
+        triple_count += count;
+    }
+
+    for( int64_t i : integers ){
+        put( integer_records, i, 8 );
+    }
+
+    std::string result( magic, sizeof( magic ) );
+    put( result, version, 4 );
+    result.resize( header_size );
+
+    // each array starts 8-byte aligned
+    size_t slot = 8;
+    auto append = [ & ]( const std::string& a, size_t record ){
+        result.resize( ( result.size() + 7 ) / 8 * 8 );
+        set( result, slot, result.size(), 8 );
+        set( result, slot + 8, a.size() / record, 8 );
+        slot += 16;
+        result += a;
+    };
+    append( function_records, function_size );
+    append( types, type_size );
+    append( triple_records, triple_size );
+    append( argument_records, argument_size );
+    append( integer_records, integer_size );
+    append( string_records, string_size );
+    append( text, text_size );
+    return result;
+}
+
+ir_view::ir_view( const char* data, size_t size ) : data( data ), size( size ) {
+    if( size < header_size || std::string_view( data, 4 ) != std::string_view( magic, 4 ) ){
+        error( "not an IR file" );
+    }
+    if( get( 4, 4 ) != version ){
+        error( "IR version " + std::to_string( get( 4, 4 ) ) + ", expected "
+               + std::to_string( version ) );
+    }
+
+    array* all[ arrays ] = { &function_records, &types, &triple_records, &argument_records,
+                             &integer_records, &string_records, &text };
+    size_t records[ arrays ] = { function_size, type_size, triple_size, argument_size,
+                                 integer_size, string_size, text_size };
+    for( size_t a = 0; a < arrays; ++a ){
+        all[ a ]->offset = get( 8 + a * 16, 8 );
+        all[ a ]->count = get( 16 + a * 16, 8 );
+        all[ a ]->record = records[ a ];
+        if( all[ a ]->offset > size || all[ a ]->count > ( size - all[ a ]->offset ) / records[ a ] ){
+            error( "truncated" );
+        }
+    }
+}
+
+uint64_t ir_view::get( uint64_t at, int bytes ) const {
+    uint64_t value = 0;
+    for( int b = 0; b < bytes; ++b ){
+        value |= uint64_t( uint8_t( data[ at + b ] ) ) << ( 8 * b );
+    }
+    return value;
+}
+
+uint64_t ir_view::field( const array& a, size_t record, size_t at, int bytes ) const {
+    if( record >= a.count ){
+        error( "record " + std::to_string( record ) + " out of range" );
+    }
+    return get( a.offset + record * a.record + at, bytes );
+}
+
+std::vector< Types > ir_view::type_list( uint64_t first, uint64_t count ) const {
+    if( first > types.count || count > types.count - first ){
+        error( "types out of range" );
+    }
+    std::vector< Types > result;
+    for( uint64_t i = 0; i < count; ++i ){
+        result.push_back( Types( get( types.offset + first + i, 1 ) ) );
+    }
+    return result;
+}
+
+std::string_view ir_view::text_at( uint64_t offset, uint64_t length ) const {
+    if( offset > text.count || length > text.count - offset ){
+        error( "text out of range" );
+    }
+    return std::string_view( data + text.offset + offset, length );
+}
+
+size_t ir_view::functions() const {
+    return function_records.count;
+}
+
+std::string_view ir_view::name( size_t f ) const {
+    return text_at( field( function_records, f, 0, 4 ), field( function_records, f, 4, 4 ) );
+}
+
+Types ir_view::type( size_t f ) const {
+    return Types( field( function_records, f, 8, 1 ) );
+}
+
+bool ir_view::defined( size_t f ) const {
+    return field( function_records, f, 9, 1 ) != 0;
+}
+
+std::vector< Types > ir_view::arguments( size_t f ) const {
+    return type_list( field( function_records, f, 12, 4 ), field( function_records, f, 16, 4 ) );
+}
+
+std::vector< Types > ir_view::variables( size_t f ) const {
+    return type_list( field( function_records, f, 12, 4 ) + field( function_records, f, 16, 4 ),
+                      field( function_records, f, 20, 4 ) );
+}
+
+size_t ir_view::triples( size_t f ) const {
+    return field( function_records, f, 28, 4 );
+}
+
+triple ir_view::at( size_t f, size_t t ) const {
+    if( t >= triples( f ) ){
+        error( "triple " + std::to_string( t ) + " out of range" );
+    }
+    size_t record = field( function_records, f, 24, 4 ) + t;
+
+    triple result;
+    result.keyword = Keywords( field( triple_records, record, 0, 1 ) );
+    result.op = Operators( field( triple_records, record, 1, 1 ) );
+    result.reused = field( triple_records, record, 2, 1 ) != 0;
+    size_t first = field( triple_records, record, 4, 4 );
+    size_t count = field( triple_records, record, 8, 4 );
+    for( size_t a = 0; a < count; ++a ){
+        result.args.emplace_back( Token( field( argument_records, first + a, 0, 4 ) ),
+                                  field( argument_records, first + a, 8, 8 ) );
+    }
+    return result;
+}
+
+size_t ir_view::integers() const {
+    return integer_records.count;
+}
+
+int64_t ir_view::integer( size_t i ) const {
+    return int64_t( field( integer_records, i, 0, 8 ) );
+}
+
+size_t ir_view::strings() const {
+    return string_records.count;
+}
+
+std::string_view ir_view::string( size_t s ) const {
+    return text_at( field( string_records, s, 0, 4 ), field( string_records, s, 4, 4 ) );
+}
+
+void ir_view::error( std::string str ) const {
+    diagnostics() << "Error in IR:\n  " << str << '\n';
+    throw std::invalid_argument( "wat" );
+}
+
+mapped_file::mapped_file( const std::string& path ){
+    int fd = ::open( path.c_str(), O_RDONLY );
+    struct stat info;
+    if( fd < 0 || ::fstat( fd, &info ) != 0 ){
+        if( fd >= 0 ){
+            ::close( fd );
+        }
+        diagnostics() << "Error in IR:\n  cannot open " << path << '\n';
+        throw std::invalid_argument( "wat" );
+    }
+    length = info.st_size;
+    if( length > 0 ){
+        void* mapping = ::mmap( nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if( mapping == MAP_FAILED ){
+            ::close( fd );
+            diagnostics() << "Error in IR:\n  cannot map " << path << '\n';
+            throw std::invalid_argument( "wat" );
+        }
+        bytes = static_cast< const char* >( mapping );
+    }
+    ::close( fd );
+}
+
+mapped_file::~mapped_file(){
+    if( bytes ){
+        ::munmap( const_cast< char* >( bytes ), length );
+    }
+}
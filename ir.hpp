@@ -0,0 +1,94 @@
+#pragma once
+
+#include "lexer.hpp"
+#include "parser.hpp"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* The triples of a module and the tables they refer to, as written by
+ * --emit-ir and read back by --from-ir.
+ *
+ * The file is a header followed by flat arrays of fixed-size records, all
+ * little-endian and addressed by offsets from the start of the file, so it can
+ * be mapped anywhere and read in place:
+ *
+ *     header      "TDIR", version, then offset and count of each array below
+ *     functions   name, type, arguments, variables, triples, each as a
+ *                 first index and count into the arrays below
+ *     types       one byte each, the arguments and variables of every function
+ *     triples     keyword, operator, reused, first argument and count
+ *     arguments   token and key
+ *     integers    the literal pool, 8 bytes each
+ *     strings     offset and length into the text
+ *     text        the bytes of the strings, then of the function names
+ *
+ * A function without triples has no entry in the map of to_triples; its
+ * record is marked as such.
+ */
+std::string encode_ir( const std::map< key, std::vector< triple > >& triples,
+                       const std::vector< function >& functions,
+                       const std::vector< int64_t >& integers,
+                       const std::vector< std::string >& strings );
+
+// Reads an encoded module in place; the data must outlive the view.
+class ir_view {
+  public:
+    // throws std::invalid_argument, with a diagnostic, unless data is a module
+    // of this version whose arrays all lie inside it
+    ir_view( const char* data, size_t size );
+
+    size_t functions() const;
+    std::string_view name( size_t f ) const;
+    Types type( size_t f ) const;
+    std::vector< Types > arguments( size_t f ) const;
+    std::vector< Types > variables( size_t f ) const;
+    bool defined( size_t f ) const;
+    size_t triples( size_t f ) const;
+    triple at( size_t f, size_t t ) const;
+
+    size_t integers() const;
+    int64_t integer( size_t i ) const;
+    size_t strings() const;
+    std::string_view string( size_t s ) const;
+
+  private:
+    struct array {
+        uint64_t offset = 0;
+        uint64_t count = 0;
+        size_t record = 1;      // bytes
+    };
+
+    const char* data;
+    size_t size;
+    array function_records, types, triple_records, argument_records, integer_records,
+          string_records, text;
+
+    uint64_t get( uint64_t at, int bytes ) const;
+    uint64_t field( const array& a, size_t record, size_t at, int bytes ) const;
+    std::vector< Types > type_list( uint64_t first, uint64_t count ) const;
+    std::string_view text_at( uint64_t offset, uint64_t length ) const;
+
+    [[noreturn]] void error( std::string str ) const;
+};
+
+// A file mapped read-only for as long as it lives.
+class mapped_file {
+  public:
+    // throws std::invalid_argument, with a diagnostic, when path cannot be mapped
+    explicit mapped_file( const std::string& path );
+    ~mapped_file();
+
+    mapped_file( const mapped_file& ) = delete;
+    mapped_file& operator=( const mapped_file& ) = delete;
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+  private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+};
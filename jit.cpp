@@ -0,0 +1,113 @@
+#include "jit.hpp"
+#include "assembler.hpp"
+#include "diagnostics.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+
+#if defined( __linux__ ) && defined( __x86_64__ )
+#include <sys/mman.h>
+#endif
+
+[[noreturn]] static void error( std::string str ){
+    diagnostics() << "Error in --run:\n  " << str << '\n';
+    throw std::invalid_argument( "run" );
+}
+
+#if defined( __linux__ ) && defined( __x86_64__ )
+
+static constexpr size_t page = 0x1000;
+
+static size_t align( size_t value, size_t to ){
+    return ( value + to - 1 ) / to * to;
+}
+
+/* Called from C++ in place of _start. The division rules use %rbx, which the
+ * host expects to survive the call; the pushes also keep the stack aligned.
+ */
+static std::vector< instruction > entry(){
+    using enum Opcode;
+    const operand rax = operand::r( Reg::Ax ), rbx = operand::r( Reg::Bx );
+    return { label( "__run" ),
+             { Push, { rbx } },
+             { Call, { operand::sym( "_main" ) } },
+             { Push, { rax } },
+             { Call, { operand::sym( "__flush" ) } },
+             { Pop, { rax } },
+             { Pop, { rbx } },
+             { Ret } };
+}
+
+int64_t run( const program& p ){
+    if( p.word != 8 ){
+        error( "only the x86-64 target runs on this host" );
+    }
+
+    assembler code( p.word );
+    code.encode( p.text );
+    code.encode( entry() );
+
+    size_t rodata = code.size();
+    size_t executable = rodata;
+    for( auto& block : p.rodata ){
+        executable += block.bytes.size();
+    }
+    executable = align( executable, page );
+    size_t size = executable;
+    for( auto& block : p.bss ){
+        size = align( size, p.word ) + block.size;
+    }
+    size = align( size, page );
+
+    void* memory = mmap( nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0 );
+    if( memory == MAP_FAILED ){
+        error( std::string( "mmap: " ) + std::strerror( errno ) );
+    }
+    char* base = static_cast< char* >( memory );
+    uint64_t address = reinterpret_cast< uintptr_t >( base );
+
+    std::map< std::string, uint64_t > symbols;
+    size_t at = rodata;
+    for( auto& block : p.rodata ){
+        symbols[ block.name ] = address + at;
+        std::memcpy( base + at, block.bytes.data(), block.bytes.size() );
+        at += block.bytes.size();
+    }
+    at = executable;
+    for( auto& block : p.bss ){
+        at = align( at, p.word );
+        symbols[ block.name ] = address + at;
+        at += block.size;
+    }
+
+    try {
+        code.link( address, symbols );
+    } catch( ... ){
+        munmap( memory, size );
+        throw;
+    }
+    std::memcpy( base, code.bytes().data(), code.size() );
+
+    if( mprotect( memory, executable, PROT_READ | PROT_EXEC ) != 0 ){
+        munmap( memory, size );
+        error( std::string( "mprotect: " ) + std::strerror( errno ) );
+    }
+
+    std::cout.flush();
+    auto main = reinterpret_cast< int64_t (*)() >( base + code.offset( "__run" ) );
+    int64_t result = main();
+
+    munmap( memory, size );
+    return result;
+}
+
+#else
+
+int64_t run( const program& ){
+    error( "not supported on this host" );
+}
+
+#endif
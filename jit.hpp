@@ -0,0 +1,15 @@
+#pragma once
+
+#include "instruction.hpp"
+
+#include <cstdint>
+
+/* Runs p in this process: the code, .rodata and .bss are placed in one
+ * anonymous mapping, _main is called through a small stub that flushes the
+ * output buffer, and its result is returned as the exit code would be.
+ *
+ * Only the x86-64 target can run on an x86-64 Linux host. The generated code
+ * addresses its data with 32-bit absolute addresses, so the mapping is made
+ * in the low 2GB.
+ */
+int64_t run( const program& p );
@@ -19,7 +19,8 @@ enum class Token {
     Function,
     Root,
     Argument,
-    If
+    If,
+    String
 };
 
 enum class Types {
@@ -102,6 +103,7 @@ class lexer {
 
     std::vector< std::pair< Types, key > > identifiers;
     std::vector< int64_t > integers;
+    std::vector< std::string > strings;
     std::vector< function > functions;
 
     friend parser;
@@ -1,43 +1,208 @@
+#include "batch.hpp"
+#include "diagnostics.hpp"
+#include "interpreter.hpp"
+#include "jit.hpp"
+#include "parallel.hpp"
 #include "lexer.hpp"
 #include "parser.hpp"
+#include "server.hpp"
+#include "stats.hpp"
+#include "target.hpp"
 #include "dimcli/libs/dimcli/cli.h"
 
-#include "unistd.h"
-
-
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <sstream>
 
 int main( int argc, char** argv ){
     Dim::Cli cli;
 
-    auto& in = cli.opt< std::string >( "i input" ).desc( "path to input file" );
+    auto& in = cli.optVec< std::string >( "i input" ).desc( "path to input file" );
+
+    auto& files = cli.optVec< std::string >( "[file]" )
+        .desc( "more input files; @file reads them from a response file" );
+
+    auto& out = cli.opt< std::string >( "o output", "out" )
+        .desc( "path to file, or the directory to write to with several inputs" );
+
+    stages want;
+    cli.opt( &want.keep_as, "a assembly", false ).desc( "also write the assembly to <output>.s" );
+
+    options opts;
+    cli.opt( &opts.optimize, "O optimize", false ).desc( "run the peephole optimizer" );
+
+    cli.opt( &opts.target, "t target", "i386" ).desc( "i386 or x86-64" );
+
+    cli.opt( &opts.profile_generate, "profile-generate", "" )
+        .desc( "count function entries and branches, writing the counts to this file at exit" );
+
+    cli.opt( &opts.profile_use, "profile-use", "" )
+        .desc( "inline, lay out and order functions using counts from --profile-generate" );
+
+    cli.opt( &opts.jobs, "j jobs", default_jobs() )
+        .desc( "threads to generate functions on, or files to compile at once" );
 
-    auto& out = cli.opt< std::string >( "o output", "out" ).desc( "path to file" );
+    cli.opt( &opts.cache, "cache", "" )
+        .desc( "directory to keep generated functions in and reuse them from" );
 
-    bool keep_as;
-    cli.opt( &keep_as, "a assembly", false ).desc( "keep the intermediary assembly file" );
+    bool server;
+    cli.opt( &server, "server", false )
+        .desc( "compile programs sent on stdin, or on --socket, until it closes" );
+
+    std::string socket;
+    cli.opt( &socket, "socket", "" ).desc( "Unix domain socket for --server to listen on" );
+
+    cli.opt( &want.emit_ir, "emit-ir", false )
+        .desc( "write the triples to <output> as binary IR instead of compiling them" );
+
+    cli.opt( &want.from_ir, "from-ir", false ).desc( "read the inputs as IR written by --emit-ir" );
+
+    bool jit;
+    cli.opt( &jit, "run", false )
+        .desc( "run the program in this process instead of writing an executable" );
+
+    bool interpret;
+    cli.opt( &interpret, "interpret", false )
+        .desc( "run the program's triples in the interpreter instead of compiling it" );
+
+    bool hot_spots;
+    cli.opt( &hot_spots, "hot-spots", false )
+        .desc( "interpret the program and print its execution counts" );
+
+    cli.opt( &want.peephole_stats, "peephole-stats", false )
+        .desc( "print how often each peephole pattern fired" );
+
+    bool print_stats;
+    cli.opt( &print_stats, "stats", false )
+        .desc( "print the time of each phase, counts of what they made and memory use" );
+
+    std::string stats_json;
+    cli.opt( &stats_json, "stats-json", "" ).desc( "write what --stats prints to this file as JSON" );
 
     if (!cli.parse(argc, argv))
         return cli.printError( std::cerr );
 
-    parser p;
+    statistics stats;
+    if( print_stats || !stats_json.empty() ){
+        count_allocations();
+    }
+    auto report = [ & ]( int status ){
+        if( print_stats ){
+            stats.print( std::cerr );
+        }
+        if( !stats_json.empty() ){
+            std::ofstream json( stats_json );
+            stats.print_json( json );
+        }
+        return status;
+    };
+
+    if( !make_target( opts.target ) ){
+        std::cerr << "Unknown target: " << opts.target << '\n';
+        return 1;
+    }
+
+    if( jit && !opts.profile_generate.empty() ){
+        std::cerr << "--run cannot write a profile, build an executable instead\n";
+        return 1;
+    }
+
+    if( server ){
+        return serve( opts, socket );
+    }
+
+    std::vector< std::string > inputs = *in;
+    inputs.insert( inputs.end(), files.begin(), files.end() );
+    if( inputs.empty() ){
+        std::cerr << "No input file\n";
+        return 1;
+    }
+
+    if( inputs.size() > 1 ){
+        if( jit || interpret || hot_spots || !opts.profile_generate.empty()
+            || !opts.profile_use.empty() )
+        {
+            std::cerr << "--run, --interpret, --hot-spots and profiles take a single input\n";
+            return 1;
+        }
+
+        // into the -o directory if given, else next to each input
+        std::vector< std::string > outputs;
+        std::set< std::string > seen;
+        for( auto& input : inputs ){
+            std::filesystem::path stem = std::filesystem::path( input ).replace_extension();
+            if( out ){
+                stem = std::filesystem::path( *out ) / stem.filename();
+            }
+            if( !seen.insert( stem.string() ).second ){
+                std::cerr << "Two inputs would both be written to " << stem.string() << '\n';
+                return 1;
+            }
+            outputs.push_back( stem.string() );
+        }
+        if( out ){
+            std::error_code ec;
+            std::filesystem::create_directories( *out, ec );
+        }
+        return report( batch( inputs, outputs, opts, want, stats ) );
+    }
+
+    parser p( opts );
 
+    if( interpret || hot_spots ){
+        try {
+            load( p, inputs[ 0 ], want.from_ir );
+            interpreter vm = p.make_interpreter();
+            stats.merge( p.stats() );
+            int64_t result;
+            {
+                auto timer = stats.time( "interpret" );
+                result = vm.run( std::cout );
+            }
+            if( hot_spots ){
+                vm.report( std::cerr );
+            }
+            return report( int( result ) );
+        } catch( std::invalid_argument& e ){
+            return 1;
+        }
+    }
+
+    program compiled;
     try {
-        p.parse( *in );
-        p.translate( *out + ".s" );
+        load( p, inputs[ 0 ], want.from_ir );
+        if( want.emit_ir ){
+            p.write_ir( *out );
+            stats.merge( p.stats() );
+            return report( 0 );
+        }
+        compiled = p.compile();
+        stats.merge( p.stats() );
+        write_outputs( compiled, *out, want.keep_as, !jit, stats );
     } catch( std::invalid_argument& e ){
         return 1;
+    } catch( std::filesystem::filesystem_error& e ){
+        std::cerr << "Error while writing " << *out << ":\n  " << e.what() << '\n';
+        return 1;
     }
 
-    std::string as = "as " + *out + ".s -o " + *out + ".o --32";
-    system( as.c_str() );
-
-    std::string ld = "ld -m elf_i386 -s -o " + *out + " " + *out + ".o";
-    system( ld.c_str() );
+    if( want.peephole_stats ){
+        print_counters( p.peephole_counters() );
+    }
 
-    if( !keep_as ){
-        std::string to_remove = *out + ".s";
-        std::remove( to_remove.c_str() );
+    if( jit ){
+        try {
+            int64_t result;
+            {
+                auto timer = stats.time( "run" );
+                result = run( compiled );
+            }
+            return report( int( result ) );
+        } catch( std::invalid_argument& e ){
+            return 1;
+        }
     }
-    std::string to_remove = *out + ".o";
-    std::remove( to_remove.c_str() );
+    return report( 0 );
 }
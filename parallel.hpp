@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// The number of threads to use when none was asked for.
+inline size_t default_jobs(){
+    return std::max( 1u, std::thread::hardware_concurrency() );
+}
+
+/* Calls work( i, worker ) for every i below count on at most jobs threads,
+ * worker being the number of the calling thread, below jobs. Items are handed
+ * out in order as threads become free. Once all have finished, the exception
+ * of the lowest failing item, if any, is rethrown.
+ */
+template< class F >
+void parallel_for( size_t count, size_t jobs, F&& work ){
+    jobs = std::max< size_t >( 1, std::min( jobs, count ) );
+    std::vector< std::exception_ptr > errors( count );
+    std::atomic< size_t > next = 0;
+
+    auto worker = [ & ]( size_t w ){
+        for( size_t i = next++; i < count; i = next++ ){
+            try {
+                work( i, w );
+            } catch( ... ){
+                errors[ i ] = std::current_exception();
+            }
+        }
+    };
+
+    std::vector< std::thread > threads;
+    for( size_t w = 1; w < jobs; ++w ){
+        threads.emplace_back( worker, w );
+    }
+    worker( 0 );
+    for( auto& t : threads ){
+        t.join();
+    }
+
+    for( auto& e : errors ){
+        if( e ){
+            std::rethrow_exception( e );
+        }
+    }
+}
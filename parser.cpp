@@ -1,16 +1,65 @@
 #include "parser.hpp"
-
+#include "cache.hpp"
+#include "diagnostics.hpp"
+#include "elf.hpp"
+#include "interpreter.hpp"
+#include "ir.hpp"
+#include "parallel.hpp"
+#include "profile.hpp"
+#include "selector.hpp"
+#include "target.hpp"
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <charconv>
+#include <iterator>
+#include <optional>
 #include <string>
+#include <tuple>
 #include <sstream>
 
+parser::parser( options opts ) : opts( opts ), arch( make_target( opts.target ) ) {
+    assert( arch );
+}
+
+parser::~parser() = default;
+
 void parser::parse( std::string path ){
-    file = std::ifstream( path );
-    if( !file ){
+    if( !source_file.open( path, std::ios::in ) ){
         error( "File not found\n" );
     }
+    parse( source_file );
+}
 
-    root = std::make_unique< ast_node >( parse_root() );
+void parser::parse_source( std::string text ){
+    source_text.str( std::move( text ) );
+    parse( source_text );
+}
+
+static void count_nodes( const ast_node& n, uint64_t& nodes, uint64_t& leaves ){
+    ++nodes;
+    leaves += n.children.empty();
+    for( auto& child : n.children ){
+        count_nodes( *child, nodes, leaves );
+    }
+}
+
+void parser::parse( std::streambuf& source ){
+    {
+        auto timer = measured.time( "parse" );
+        file.rdbuf( &source );
+        file.clear();
+        lowered.reset();
+        root = std::make_unique< ast_node >( parse_root() );
+    }
+
+    // the parser reads characters, there is no token stream to count
+    uint64_t nodes = 0;
+    uint64_t leaves = 0;
+    count_nodes( *root, nodes, leaves );
+    measured.add( "AST leaves", leaves );
+    measured.add( "AST nodes", nodes );
 }
 
 
@@ -54,6 +103,9 @@ ast_node parser::parse_function(){
 void parser::parse_args( function& f, bool definition ){
     eat_char( '(' );
     while( file.peek() != ')' ){
+        if( file.peek() == EOF ){
+            error( "Missing ')'\n" );
+        }
         std::string word;
         file >> word;
         key k;
@@ -91,12 +143,24 @@ std::vector< std::unique_ptr< ast_node > > parser::parse_expressions(){
     while( ( c = file.peek() ) != '}' ){
         //std::cout << "wat\n";
         bool is_if = false;
-        while( ( c = file.get() ) != ';' ){
+        bool quoted = false;
+        while( ( c = file.get() ) != ';' || quoted ){
+            if( file.eof() ){
+                error( "Missing ';'\n" );
+            }
             expr += c;
-            if( lex.symbols.get_token( expr, &k ) == If ){
+            if( c == '"' ){
+                quoted = !quoted;
+            } else if( c == '\\' && quoted ){
+                expr += char( file.get() );
+            }
+            if( !quoted && lex.symbols.get_token( expr, &k ) == If ){
                 std::string condition;
                 eat_char( '(' );
                 while( ( c = file.get() ) != ')' ){
+                    if( file.eof() ){
+                        error( "Missing ')'\n" );
+                    }
                     condition += c;
                 }
                 eat_char( '{' );
@@ -112,8 +176,17 @@ std::vector< std::unique_ptr< ast_node > > parser::parse_expressions(){
 
         expr = desugar( expr );
         std::string current = "";
-        for( char c : expr ){
-            if( c == '|' ){
+        quoted = false;
+        for( size_t i = 0; i < expr.size(); ++i ){
+            char c = expr[ i ];
+            if( c == '"' ){
+                quoted = !quoted;
+            } else if( c == '\\' && quoted && i + 1 < expr.size() ){
+                current += c;
+                current += expr[ ++i ];
+                continue;
+            }
+            if( c == '|' && !quoted ){
                 result.emplace_back( std::make_unique< ast_node >( parse_expr( current ) ) );
                 current = "";
             } else {
@@ -132,6 +205,9 @@ std::vector< std::unique_ptr< ast_node > > parser::parse_expressions(){
 }
 
 std::string cut_spaces( std::string str ){
+    if( std::all_of( str.begin(), str.end(), []( char c ){ return std::isspace( c ); } ) ){
+        return "";
+    }
     size_t begin = 0;
     size_t end = str.size() - 1;
 
@@ -145,9 +221,27 @@ std::string cut_spaces( std::string str ){
     return std::string( str.begin() + begin, str.begin() + end + 1 );
 }
 
+// whether every bracket outside string literals is closed, and only once
+static bool balanced( const std::string& str ){
+    int counter = 0;
+    bool quoted = false;
+    for( size_t i = 0; i < str.size(); ++i ){
+        if( quoted && str[ i ] == '\\' ){
+            ++i;
+        } else if( str[ i ] == '"' ){
+            quoted = !quoted;
+        } else if( !quoted && str[ i ] == '(' ){
+            ++counter;
+        } else if( !quoted && str[ i ] == ')' && --counter < 0 ){
+            return false;
+        }
+    }
+    return counter == 0;
+}
+
 std::string remove_brackets( std::string str ){
     int counter = 0;
-    if( str.front() != '(' ){
+    if( str.empty() || str.front() != '(' ){
         return str;
     }
     size_t pos = 0;
@@ -171,6 +265,39 @@ void skipws( std::stringstream& ss ){
     }
 }
 
+std::string unescape( std::string str ){
+    std::string result;
+    for( size_t i = 0; i < str.size(); ++i ){
+        if( str[ i ] != '\\' || i + 1 == str.size() ){
+            result += str[ i ];
+            continue;
+        }
+        switch( str[ ++i ] ){
+            case 'n':
+                result += '\n';
+                break;
+            case 't':
+                result += '\t';
+                break;
+            case '0':
+                result += '\0';
+                break;
+            default:
+                result += str[ i ];
+        }
+    }
+    return result;
+}
+
+key parser::add_string( std::string str ){
+    auto found = std::find( lex.strings.begin(), lex.strings.end(), str );
+    if( found != lex.strings.end() ){
+        return found - lex.strings.begin();
+    }
+    lex.strings.push_back( std::move( str ) );
+    return lex.strings.size() - 1;
+}
+
 std::string parser::desugar( std::string str ){
     std::string result;
     std::string word;
@@ -185,11 +312,12 @@ std::string parser::desugar( std::string str ){
             ++i;
         }
 //        if( isdigit( str[ i ] ) ){
+            result += "print \"";
             while( i != str.size() ){
                 if( !isdigit( str[ i ] ) ){
                     error( "printn expecting a number, got: " + str );
                 }
-                result += "print " + std::to_string( int( str[ i ] ) ) + "|";
+                result += str[ i ];
                 ++i;
             }
         // } else {
@@ -203,7 +331,7 @@ std::string parser::desugar( std::string str ){
 
         // }
 
-        result += "print 10";
+        result += "\\n\"";
     } else {
         return str;
     }
@@ -215,14 +343,25 @@ ast_node parser::parse_expr( std::string str ){
     std::string word;
 
     str = cut_spaces( str );
+    if( !balanced( str ) ){
+        error( "Unbalanced brackets in: " + str );
+    }
     str = remove_brackets( str );
 
     if( str.empty() ){
         return { None, 0 };
     }
+    if( str.size() >= 2 && str.front() == '"' && str.back() == '"' ){
+        return { String, add_string( unescape( str.substr( 1, str.size() - 2 ) ) ) };
+    }
     if( std::all_of( str.begin(), str.end(), []( char c ){ return isdigit( c ); } ) )
     {
-        lex.integers.push_back( std::stoi( str ) );
+        int32_t value;
+        auto [ end, ec ] = std::from_chars( str.data(), str.data() + str.size(), value );
+        if( ec != std::errc() ){
+            error( "Literal out of range: " + str );
+        }
+        lex.integers.push_back( value );
         return { Literal, lex.integers.size() - 1 };
     }
 
@@ -243,7 +382,8 @@ ast_node parser::parse_expr( std::string str ){
 
         expr.children.emplace_back( std::make_unique< ast_node >( token, k ) );
         std::string remainder;
-        std::getline( ss, remainder, ';' );
+        // the statement is already cut at its ';', but a string may contain one
+        std::getline( ss, remainder, '\0' );
         expr.children.emplace_back( std::make_unique< ast_node >( parse_expr( remainder ) ) );
 
     }
@@ -433,234 +573,307 @@ void parser::traverse(
     }
 }
 
-std::map< key, std::vector< triple > > parser::to_triples(){
-    print_ast();
-    std::map< key, std::vector< triple > > functions;
-    for( auto& child : root->children ){
-        traverse( child.get(), functions, 0 );
+std::optional< std::string > malformed( const std::map< key, std::vector< triple > >& triples,
+                                        key f, size_t t,
+                                        const std::vector< function >& functions,
+                                        const std::vector< int64_t >& integers,
+                                        const std::vector< std::string >& strings )
+{
+    const std::vector< triple >& ts = triples.at( f );
+    const triple& tr = ts[ t ];
+    auto& args = tr.args;
+
+    // fewest and most arguments
+    size_t least = 0, most = 0;
+    switch( tr.keyword ){
+        case Keywords::Return:
+        case Keywords::Declaration:
+            most = 1;
+            break;
+        case Keywords::Ifjump:
+        case Keywords::Print:
+            least = most = 1;
+            break;
+        case Keywords::Label:
+            break;
+        case Keywords::None:
+            switch( tr.op ){
+                case Operators::Intplus:
+                case Operators::Intmin:
+                case Operators::Intmul:
+                case Operators::Intdiv:
+                case Operators::Equals:
+                    least = most = 2;
+                    break;
+                case Operators::Call:
+                    least = 1;
+                    most = SIZE_MAX;
+                    break;
+                default:
+                    return "has an unknown operator";
+            }
+            break;
+        default:
+            return "has an unknown keyword";
+    }
+    if( args.size() < least || args.size() > most ){
+        return "has " + std::to_string( args.size() ) + " arguments";
+    }
+
+    for( auto [ token, k ] : args ){
+        bool valid;
+        switch( token ){
+            case Token::None:       valid = true; break;
+            case Token::Literal:    valid = k < integers.size(); break;
+            case Token::String:     valid = k < strings.size(); break;
+            case Token::Identifier: valid = k < functions[ f ].variables.size(); break;
+            case Token::Argument:   valid = k < functions[ f ].arguments.size(); break;
+            case Token::Function:   valid = k < functions.size() && triples.count( k ); break;
+            case Token::Expression:
+                // only earlier triples, so expressions cannot loop
+                valid = k < t && ts[ k ].keyword == Keywords::None
+                     && ts[ k ].op != Operators::Equals;
+                break;
+            default:                valid = false; break;
+        }
+        if( !valid ){
+            return "refers to something that does not exist";
+        }
     }
-    return functions;
-}
-
-std::string parser::arithmetic( triple t, std::string op, std::string s1, std::string s2,
-                                std::string indent ){
-    std::string push;
 
-    if( t.reused ){
-        push += indent + "push %eax\n";
+    if( tr.keyword == Keywords::None && tr.op == Operators::Call
+     && args[ 0 ].first != Token::Function )
+    {
+        return "calls something that is not a function";
     }
-    if( t.args[ 0 ].first == Token::Expression
-     && t.args[ 1 ].first == Token::Expression )
+    if( tr.keyword == Keywords::None && tr.op == Operators::Equals
+     && args[ 0 ].first != Token::Identifier && args[ 0 ].first != Token::Argument )
     {
-        return indent + "mov %eax, %edx\n" + indent + "pop %eax\n"
-            + indent + op + " %edx, %eax\n" + push;
+        return "assigns to something that is not a variable";
     }
+    return std::nullopt;
+}
 
-    if( t.args[ 0 ].first == Token::Expression ){
-        return indent + op + " " + s2
-            + ", %eax\n" + push;
-    }
-    if( t.args[ 1 ].first == Token::Expression ){
-        std::string begin = indent + "mov %eax, %edx\n" + indent + "mov " + s1 + ", %eax\n";
-        return begin + indent + op + " "
-            + "%edx, %eax\n" + push;
+/* The records are copied into the lexer's tables and a map of triples, not
+ * used in place: everything after this, from inlining and the cache keys to
+ * the selector and the interpreter, works on those. The copy is one pass over
+ * fixed-size records, without the tokenising, parsing and lowering it
+ * replaces, and the records must all be checked anyway before a single one
+ * can be trusted.
+ */
+void parser::read_ir( const std::string& path ){
+    auto timer = measured.time( "read IR" );
+    mapped_file mapping( path );
+    ir_view ir( mapping.data(), mapping.size() );
+
+    auto fail = [ & ]( const std::string& what ){
+        diagnostics() << "Error in IR:\n  " << what << '\n';
+        throw std::invalid_argument( "wat" );
+    };
+
+    for( size_t i = 0; i < ir.integers(); ++i ){
+        lex.integers.push_back( ir.integer( i ) );
+    }
+    for( size_t s = 0; s < ir.strings(); ++s ){
+        lex.strings.emplace_back( ir.string( s ) );
+    }
+    for( size_t f = 0; f < ir.functions(); ++f ){
+        lex.functions.push_back( { std::string( ir.name( f ) ), ir.type( f ), ir.arguments( f ),
+                                   ir.variables( f ) } );
+        auto& fn = lex.functions.back();
+        auto known = []( Types type ){ return type == Types::Int || type == Types::Char; };
+        if( !known( fn.type ) || !std::all_of( fn.arguments.begin(), fn.arguments.end(), known )
+         || !std::all_of( fn.variables.begin(), fn.variables.end(), known ) )
+        {
+            fail( "function " + fn.name + " has an unknown type" );
+        }
     }
 
-    return indent + "mov " + s1 + ", %eax\n" + indent +
-        "mov " + s2
-        + ", %edx\n" + indent + op + " %edx, %eax\n" + push;
+    lowered.emplace();
+    for( size_t f = 0; f < ir.functions(); ++f ){
+        if( !ir.defined( f ) ){
+            continue;
+        }
+        std::vector< triple >& ts = ( *lowered )[ f ];
+        for( size_t t = 0; t < ir.triples( f ); ++t ){
+            ts.push_back( ir.at( f, t ) );
+        }
+    }
 
+    // the code generator and the interpreter index the tables with these unchecked
+    for( auto& [ f, ts ] : *lowered ){
+        for( size_t t = 0; t < ts.size(); ++t ){
+            if( auto why = malformed( *lowered, f, t, lex.functions, lex.integers, lex.strings ) ){
+                fail( "in " + lex.functions[ f ].name + ", triple " + std::to_string( t ) + " "
+                      + *why );
+            }
+        }
+    }
 }
 
-std::string parser::div( triple t, std::string s1, std::string s2,
-                         std::string indent )
-{
-    std::string clear = indent + "xor %edx, %edx\n";
-    std::string push;
-    if( t.reused ){
-        push = indent + "push %eax\n";
-    }
-    if( t.args[ 0 ].first == Expression && t.args[ 1 ].first == Expression ){
-        return clear + indent + "mov %eax, %ebx\n" + indent + "pop %eax\n"
-            + indent + "div %ebx\n" + push;
-    }
-    if( t.args[ 0 ].first == Expression ){
-        return clear +
-            indent + "mov " + s2 + ", %ebx\n" + indent + "div %ebx" + "\n"
-            + push;
-    }
-    if( t.args[ 1 ].first == Expression ){
-        return clear + indent + "mov %eax, %ebx\n" +
-            indent + "mov " + s1 + ", %eax\n" + indent + "div %ebx\n" + push;
-    }
-    return clear + indent + "mov " + s2 + ", %ebx\n" + indent + "mov " + s1 + ", %eax\n"
-        + indent + "div %ebx\n" + push;
+void parser::write_ir( const std::string& path ){
+    write_file( encode_ir( to_triples(), lex.functions, lex.integers, lex.strings ), path );
 }
 
-std::string parser::to_instructions( triple t, std::string indent, key fkey ){
-    //std::cout << key( t.keyword ) << "op: " << key( t.op ) << " size: " << t.args.size() << '\n';
-    std::string s1 = t.args.size() == 0 ? "" :
-        to_instruction( t.args[ 0 ].first, t.args[ 0 ].second, fkey );
-    std::string s2 = t.args.size() < 2 ? "" :
-        to_instruction( t.args[ 1 ].first, t.args[ 1 ].second, fkey );
-
-    std::string result;
-    size_t pop = 0;
-
-    if( t.keyword != Keywords::None ){
-        using enum Keywords;
-        switch( Keywords( t.keyword ) ){
-            case Return:
-                if( t.args[ 0 ].first == Token::Expression ){
-                    return indent + indent + "add $" +
-                        std::to_string( lex.functions[ fkey ].variables.size() * 4 ) +
-                        ", %esp\n" + indent + "ret\n";
-                }
-                return indent + "mov " + s1 +
-                       ", %eax\n" +  indent + "add $" +
-                        std::to_string( lex.functions[ fkey ].variables.size() * 4 ) +
-                        ", %esp\n" +
-                       indent + "ret\n";
-            case Declaration:
-                if( t.args.size() > 0 ){
-                //if( t.args[ 0 ].first != Token::None ){
-                    return indent + "push " + s1
-                        + "\n";
-                }
-                return indent + "push $0\n";
-            case Ifjump:
-                if( t.args[ 0 ].first == Expression ){
-                    return indent + "mov $0, %ebx\n" + indent + "cmp %ebx, %eax\n"
-                        + indent + "je lbl" + std::to_string( lbl ) + "\n";
-                }
-                return indent + "mov $0, %ebx\n"
-                    + indent + "cmp " + s1 + ", %ebx\n"
-                    + indent + "je lbl" + std::to_string( lbl ) + "\n";
-            case Label:
-                return "lbl" + std::to_string( lbl++ ) + ":\n";
-            case Print:
-                // if( t.args[ 0 ].first == Expression ){
-                //     return indent + "push %eax\n"
-                //         + indent + "movl $4, %eax\n " + indent + "movl $1, %ebx\n"
-                //         + indent + "mov %esp, %ecx\n" + indent +
-                //         "movl $4, %edx\n" + indent + "int $0x80\n" + indent + "add $4, %esp\n";
-                // }
-                // if( t.args[ 0 ].first == Literal ){
-                    return indent + "push " + s1 + "\n"
-                        + indent + "movl $4, %eax\n " + indent + "movl $1, %ebx\n"
-                        + indent + "mov %esp, %ecx\n" + indent +
-                        "movl $4, %edx\n" + indent + "int $0x80\n" + indent + "add $4, %esp\n";
-                // }
-                // result = "";
-                // for( char c : s1 ){
-                //     if( isdigit( c ) )
-                //         result += c;
-                //     else
-                //         break;
-                // }
-                // return indent + "mov " + s1 + ", %ecx\n"
-                //         + indent + "movl $4, %eax\n" + indent + "movl $1, %ebx\n"
-                //         + indent + "movl $4, %edx\n" + indent + "int $0x80\n";
-            default:
-                throw std::exception();
-        }
-    } else if( t.op != Operators::None ) {
-        using enum Operators;
-        switch( Operators( t.op ) ){
-            case Intplus:
-                return arithmetic( t, "add", s1, s2, indent );
-            case Intmin:
-                return arithmetic( t, "sub", s1, s2, indent );
-            case Intmul:
-                return arithmetic( t, "imul", s1, s2, indent );
-            case Intdiv:
-                return div( t, s1, s2, indent );
-            case Equals:
-                if( t.args[ 1 ].first == Expression ){
-                    return indent + "mov %eax, " + s1 + '\n';
-                }
-                return indent + "movl " + s2 +
-                    ", " + s1 + "\n";
-            case Call:
-                for( size_t i = t.args.size() - 1; i > 0; --i ){
-                    if( t.args[ i ].first != Token::None ){
-                        if( t.args[ i ].first == Expression ){
-                            result += indent + "push %eax\n";
-                        } else {
-                            result += indent + "push "
-                                + to_instruction( t.args[ i ].first, t.args[ i ].second, fkey )
-                                + "\n";
-                        }
-
-                        pop += 4;
-                    }
-                }
-                return result + indent + "call " + s1 + '\n' + indent + "add $"
-                    + std::to_string( pop ) + ", %esp\n";
-        }
+const std::map< key, std::vector< triple > >& parser::to_triples(){
+    if( lowered ){
+        return *lowered;
     }
-    assert( false );
-}
-
-std::string parser::to_instruction( Token token, key k, key fkey ){
-    switch( token ){
-        case Expression:
-            return "%eax";
-        case Argument:
-            return std::to_string( 4 * ( lex.functions[ fkey ].variables.size() + 1 + k ) )
-                + "(%esp)";
-        case Identifier:
-            return std::to_string( 4 * ( lex.functions[ fkey ].variables.size() - 1 - k ) )
-                + "(%esp)";
-        case Keyword:
-            switch( Keywords( k ) ){
-                case Keywords::Return:
-                    return "ret";
-                default:
-                    return "";
-            }
-        case Literal:
-            return std::string( "$" ) + std::to_string( lex.integers[ k ] );
-        case Function:
-            return "_" + lex.functions[ k ].name;
-        default:
-            return "";
+    auto timer = measured.time( "to_triples" );
+    print_ast();
+    std::map< key, std::vector< triple > > functions;
+    for( auto& child : root->children ){
+        traverse( child.get(), functions, 0 );
+    }
+    uint64_t count = 0;
+    for( auto& [ f, ts ] : functions ){
+        count += ts.size();
     }
+    measured.add( "triples", count );
+    return lowered.emplace( std::move( functions ) );
 }
 
 void parser::translate( std::string path ){
-    output_file = std::ofstream( path );
-    std::string output;
+    std::string text;
+    append( text, compile() );
+    write_file( text, path );
+}
 
-    std::string header = ".text\n    .global _start\n";
+program parser::compile(){
+    program result;
+    result.word = arch->word();
+    result.globals.push_back( "_start" );
 
-    std::string init = "_start:\n  call _main\n";
+    auto triples = to_triples();
+
+    profile prof( triples );
+    bool instrument = !opts.profile_generate.empty();
+    bool guided = !opts.profile_use.empty() && prof.read( opts.profile_use, arch->word() );
+    if( guided ){
+        inline_hot_calls( triples, lex.functions, prof );
+    }
 
-    init += "  mov %eax, %ebx\n  mov $1, %eax\n  int $0x80\n\n";
+    std::optional< statistics::timer > phase;
+    phase.emplace( measured, "generate" );
 
-    auto triples = to_triples();
+    std::vector< key > keys;
+    for( auto& [ fkey, triplevec ] : triples ){
+        keys.push_back( fkey );
+    }
+
+    std::optional< code_cache > cache;
+    if( !opts.cache.empty() ){
+        cache.emplace( opts.cache );
+    }
+
+    // Functions only share read-only tables, so each is generated on its own;
+    // the peephole counters are kept per thread and added up afterwards.
+    // Functions found in the cache are not counted.
+    std::vector< std::vector< instruction > > codes( keys.size() );
+    std::atomic< uint64_t > hits = 0;
+    std::vector< peephole > optimizers( std::max< size_t >( 1, std::min( opts.jobs, keys.size() ) ) );
+    parallel_for( keys.size(), optimizers.size(), [ & ]( size_t i, size_t worker ){
+        key fkey = keys[ i ];
+
+        std::string id;
+        std::vector< key > used_strings;
+        if( cache ){
+            std::string flags = opts.target + ( opts.optimize ? " -O" : "" );
+            if( instrument ){
+                flags += " counters@" + std::to_string( prof.first( fkey ) );
+            }
+            if( guided ){
+                const std::vector< triple >& ts = triples.at( fkey );
+                for( size_t t = 0; t < ts.size(); ++t ){
+                    if( ts[ t ].keyword == Keywords::Ifjump ){
+                        auto [ runs, through ] = prof.branch( fkey, t );
+                        flags += " " + std::to_string( runs ) + "/" + std::to_string( through );
+                    }
+                }
+            }
+            id = code_cache::key_of( triples.at( fkey ), lex.functions, lex.integers, lex.strings,
+                                     fkey, flags, used_strings );
+            if( auto hit = cache->load( id, used_strings ) ){
+                ++hits;
+                codes[ i ] = std::move( *hit );
+                return;
+            }
+        }
 
-    std::map< std::string, std::string > f_codes;
-    for( auto [ fkey, triplevec ] : triples ){
-        eax_full = false;
-        header += "    .global _" + lex.functions[ fkey ].name + "\n";
-        //output += "_" + lex.functions[ fkey ].name + ":\n";
-        for( auto tri : triplevec ){
-            output += to_instructions( tri, "  ", fkey );
+        selector s( *arch, lex.functions, lex.integers, lex.strings, fkey );
+        if( instrument ){
+            s.counters = prof.first( fkey );
+        }
+        std::vector< instruction > output = s.select( triples.at( fkey ) );
+        arch->frame( lex.functions[ fkey ], s.saved_registers(), output );
+        if( opts.optimize ){
+            optimizers[ worker ].run( output );
+        }
+        if( guided ){
+            move_cold_blocks( output, s.branch_labels(), fkey, prof );
+        }
+        if( cache ){
+            cache->store( id, used_strings, output );
         }
-        f_codes[ "_" + lex.functions[ fkey ].name ] = output;
-        output = "";
+        codes[ i ] = std::move( output );
+    } );
+    for( auto& o : optimizers ){
+        optimizer.merge( o );
+    }
+    measured.add( "functions", keys.size() );
+    if( cache ){
+        measured.add( "cached functions", hits );
+    }
+
+    phase.emplace( measured, "layout" );
+
+    // by name, or hottest first when there is a profile
+    std::vector< std::tuple< uint64_t, std::string, size_t > > order;
+    for( size_t i = 0; i < keys.size(); ++i ){
+        order.emplace_back( prof.entries( keys[ i ] ), "_" + lex.functions[ keys[ i ] ].name, i );
+    }
+    std::sort( order.begin(), order.end(), []( auto& a, auto& b ){
+        return std::get< 0 >( a ) != std::get< 0 >( b ) ? std::get< 0 >( a ) > std::get< 0 >( b )
+                                                        : std::get< 1 >( a ) < std::get< 1 >( b ); } );
+
+    result.text = arch->entry( instrument );
+    for( auto& i : arch->runtime() ){
+        result.text.push_back( std::move( i ) );
     }
-    output_file << header << '\n' << init;
-    for( auto [ f, inst ] : f_codes ){
-        output_file << f << ":\n";
-        output_file << inst << '\n';
+    if( instrument ){
+        for( auto& i : arch->profile_writer( prof.size() ) ){
+            result.text.push_back( std::move( i ) );
+        }
     }
-    //output_file << header << '\n' << output;
-    output_file.close();
+    for( auto& [ hits, f, i ] : order ){
+        auto& inst = codes[ i ];
+        result.globals.push_back( f );
+        result.text.push_back( label( f ) );
+        result.text.insert( result.text.end(), std::make_move_iterator( inst.begin() ),
+                            std::make_move_iterator( inst.end() ) );
+    }
+    for( size_t k = 0; k < lex.strings.size(); ++k ){
+        result.rodata.push_back( { "__str" + std::to_string( k ), lex.strings[ k ],
+                                   lex.strings[ k ].size() } );
+    }
+    result.bss = arch->bss();
+    if( instrument ){
+        std::string header = prof.header( arch->word() );
+        result.rodata.push_back( { "__profile_header", header, header.size() } );
+        result.rodata.push_back( { "__profile_path", opts.profile_generate + '\0',
+                                   opts.profile_generate.size() + 1 } );
+        result.bss.push_back( { "__profile_counters", "",
+                                size_t( prof.size() * arch->word() ) } );
+    }
+    measured.add( "instructions", result.text.size() );
+    return result;
+}
+
+interpreter parser::make_interpreter(){
+    return interpreter( to_triples(), lex.functions, lex.integers, lex.strings, arch->word() );
 }
 
 void parser::error( std::string str ){
-    std::cerr << ( "Error on line " + std::to_string( line ) + ":\n  " + str + "\n" );
+    diagnostics() << ( "Error on line " + std::to_string( line ) + ":\n  " + str + "\n" );
     throw std::invalid_argument( "wat" );
 }
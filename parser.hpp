@@ -1,8 +1,14 @@
 #pragma once
 
+#include "instruction.hpp"
 #include "lexer.hpp"
+#include "peephole.hpp"
+#include "stats.hpp"
 
 #include <fstream>
+#include <map>
+#include <optional>
+#include <sstream>
 
 /*Grammar:
 
@@ -43,28 +49,82 @@ struct triple{
     triple( Operators op ) : op( op ){}
 };
 
+/* Why triple t of function f cannot be generated or interpreted, or nothing
+ * when it can: its keyword and operator are known and have the arguments they
+ * take, and every key lies inside its table. Expressions refer to an earlier
+ * triple that makes a value, and calls to a function with code. The parser
+ * only makes such triples; this is for those read from elsewhere.
+ */
+std::optional< std::string > malformed( const std::map< key, std::vector< triple > >& triples,
+                                        key f, size_t t,
+                                        const std::vector< function >& functions,
+                                        const std::vector< int64_t >& integers,
+                                        const std::vector< std::string >& strings );
+
+class interpreter;
+class target;
+
+struct options {
+    bool optimize = false;
+    std::string target = "i386";
+    std::string profile_generate = "";  // instrumented programs write their counts here
+    std::string profile_use = "";       // counts that drive inlining and layout
+    size_t jobs = 1;                    // threads generating functions
+    std::string cache = "";             // directory of generated functions kept between builds
+};
+
 class parser {
     using enum Token;
 
+    options opts;
+    std::unique_ptr< target > arch;
+    peephole optimizer;
+    statistics measured;
+
     std::unique_ptr< ast_node > root;
+    std::optional< std::map< key, std::vector< triple > > > lowered;    // from read_ir or to_triples
     lexer lex;
-    std::ifstream file;
-    std::ofstream output_file;
+    std::filebuf source_file;
+    std::stringbuf source_text;
+    std::istream file{ nullptr };   // reads from one of the above
 
-    bool eax_full = false;
     size_t line = 1;
-    size_t lbl = 0;
 
   public:
+    parser( options opts = {} );
+    ~parser();
+
+    const target& machine() const { return *arch; }
+
     void parse( std::string path );
+    // parses text as if it were the contents of a file
+    void parse_source( std::string text );
+
+    // reads a module written by write_ir in place of parsing one
+    void read_ir( const std::string& path );
+    void write_ir( const std::string& path );
 
     void print_ast();
 
+    // writes the assembly text of compile() to path
     void translate( std::string path );
 
-    std::map< key, std::vector< triple > > to_triples();
+    program compile();
+
+    interpreter make_interpreter();
+
+    // lowers the AST once, later calls return the same triples
+    const std::map< key, std::vector< triple > >& to_triples();
+
+    std::vector< std::pair< std::string, size_t > > peephole_counters() const {
+        return optimizer.counters();
+    }
+
+    // phase times and counts of everything this parser did so far
+    const statistics& stats() const { return measured; }
 
   private:
+    void parse( std::streambuf& source );
     ast_node parse_root();
     ast_node parse_function();
     void parse_args( function& f, bool definition = false );
@@ -75,17 +135,11 @@ class parser {
     void eat_char( char expected );
     void skipws();
     std::string desugar( std::string str );
+    key add_string( std::string str );
 
     void traverse( ast_node* current,
                    std::map< key, std::vector< triple > >& functions,
                    key index = 0 );
 
-    std::string to_instructions( triple t, std::string indent = "", key fkey = 0 );
-    std::string to_instruction( Token token, key k, key fkey = 0 );
-
-    std::string arithmetic( triple t, std::string op,
-                            std::string s1, std::string s2, std::string indent );
-
-    std::string div( triple t, std::string s1, std::string s2, std::string indent );
     void error( std::string str );
 };
@@ -0,0 +1,114 @@
+#include "peephole.hpp"
+
+using enum Opcode;
+using out = std::vector< instruction >;
+
+static bool is_esp_adjust( const instruction& i ){
+    return ( i.op == Add || i.op == Sub )
+        && i.operands[ 0 ].kind == operand::Kind::Immediate
+        && i.operands[ 1 ].is_reg( Reg::Sp );
+}
+
+static int64_t esp_delta( const instruction& i ){
+    return i.op == Add ? i.operands[ 0 ].value : -i.operands[ 0 ].value;
+}
+
+peephole::peephole(){
+    patterns = {
+        // push X; pop X
+        // push X; pop %r   ->  mov X, %r
+        { "push-pop", 2, []( const instruction* w, out& result ){
+            if( w[ 0 ].op != Push || w[ 1 ].op != Pop
+             || w[ 1 ].operands[ 0 ].kind != operand::Kind::Register
+             || w[ 0 ].operands[ 0 ].is_reg( Reg::Sp ) )
+            {
+                return false;
+            }
+            if( w[ 0 ].operands[ 0 ] != w[ 1 ].operands[ 0 ] ){
+                result = { { Mov, { w[ 0 ].operands[ 0 ], w[ 1 ].operands[ 0 ] } } };
+            }
+            return true;
+        } },
+        // add $0, %esp
+        { "zero-esp-adjust", 1, []( const instruction* w, out& ){
+            return is_esp_adjust( w[ 0 ] ) && w[ 0 ].operands[ 0 ].value == 0;
+        } },
+        // add $a, %esp; add $b, %esp  ->  add $a+b, %esp
+        { "merge-esp-adjust", 2, []( const instruction* w, out& result ){
+            if( !is_esp_adjust( w[ 0 ] ) || !is_esp_adjust( w[ 1 ] ) ){
+                return false;
+            }
+            int64_t delta = esp_delta( w[ 0 ] ) + esp_delta( w[ 1 ] );
+            result = { { delta < 0 ? Sub : Add,
+                         { operand::imm( delta < 0 ? -delta : delta ), operand::r( Reg::Sp ) } } };
+            return true;
+        } },
+        // mov %r, %r
+        { "self-move", 1, []( const instruction* w, out& ){
+            return w[ 0 ].op == Mov && w[ 0 ].operands[ 0 ] == w[ 0 ].operands[ 1 ];
+        } },
+        // mov %r, M; mov M, %r  ->  mov %r, M
+        { "store-reload", 2, []( const instruction* w, out& result ){
+            if( w[ 0 ].op != Mov || w[ 1 ].op != Mov
+             || w[ 0 ].operands[ 0 ].kind != operand::Kind::Register
+             || w[ 0 ].operands[ 1 ].kind != operand::Kind::Memory
+             || w[ 0 ].operands[ 0 ] != w[ 1 ].operands[ 1 ]
+             || w[ 0 ].operands[ 1 ] != w[ 1 ].operands[ 0 ] )
+            {
+                return false;
+            }
+            result = { w[ 0 ] };
+            return true;
+        } },
+    };
+    hits.assign( patterns.size(), 0 );
+}
+
+void peephole::run( std::vector< instruction >& code ){
+    while( pass( code ) );
+}
+
+bool peephole::pass( std::vector< instruction >& code ){
+    std::vector< instruction > result;
+    result.reserve( code.size() );
+    bool changed = false;
+
+    size_t i = 0;
+    while( i < code.size() ){
+        bool matched = false;
+        for( size_t p = 0; p < patterns.size(); ++p ){
+            if( i + patterns[ p ].length > code.size() ){
+                continue;
+            }
+            std::vector< instruction > replacement;
+            if( patterns[ p ].rewrite( &code[ i ], replacement ) ){
+                result.insert( result.end(), replacement.begin(), replacement.end() );
+                i += patterns[ p ].length;
+                ++hits[ p ];
+                matched = true;
+                break;
+            }
+        }
+        if( !matched ){
+            result.push_back( std::move( code[ i++ ] ) );
+        }
+        changed |= matched;
+    }
+
+    code = std::move( result );
+    return changed;
+}
+
+std::vector< std::pair< std::string, size_t > > peephole::counters() const {
+    std::vector< std::pair< std::string, size_t > > result;
+    for( size_t p = 0; p < patterns.size(); ++p ){
+        result.emplace_back( patterns[ p ].name, hits[ p ] );
+    }
+    return result;
+}
+
+void peephole::merge( const peephole& other ){
+    for( size_t p = 0; p < hits.size(); ++p ){
+        hits[ p ] += other.hits[ p ];
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "instruction.hpp"
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Pattern-driven rewriting of short instruction windows, iterated until no
+ * pattern applies. A rewrite only touches the registers and memory named in
+ * its window, so it holds on either target, whatever registers carry
+ * arguments there. The patterns rely on the code generator never testing the
+ * flags left by an adjustment of %esp.
+ */
+class peephole {
+    struct pattern {
+        std::string name;
+        size_t length;
+        // fills the replacement and returns true when the window matches
+        std::function< bool( const instruction*, std::vector< instruction >& ) > rewrite;
+    };
+
+    std::vector< pattern > patterns;
+    std::vector< size_t > hits;
+
+  public:
+    peephole();
+
+    void run( std::vector< instruction >& code );
+
+    std::vector< std::pair< std::string, size_t > > counters() const;
+
+    // adds the hits of another instance, e.g. one per thread
+    void merge( const peephole& other );
+
+  private:
+    bool pass( std::vector< instruction >& code );
+};
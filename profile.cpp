@@ -0,0 +1,296 @@
+#include "profile.hpp"
+#include "diagnostics.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+
+static const char magic[ 8 ] = { 'T', 'D', 'P', 'R', 'O', 'F', '1', '\0' };
+
+profile::profile( const std::map< key, std::vector< triple > >& triples ){
+    for( auto& [ f, ts ] : triples ){
+        firsts[ f ] = counters++;
+        for( size_t t = 0; t < ts.size(); ++t ){
+            if( ts[ t ].keyword == Keywords::Ifjump ){
+                branches[ { f, t } ] = counters;
+                counters += 2;
+            }
+        }
+    }
+}
+
+static void put( std::string& out, uint64_t value, int bytes ){
+    for( int b = 0; b < bytes; ++b ){
+        out += char( value >> ( 8 * b ) );
+    }
+}
+
+static uint64_t get( const std::string& in, size_t at, int64_t bytes ){
+    uint64_t value = 0;
+    for( int64_t b = 0; b < bytes; ++b ){
+        value |= uint64_t( uint8_t( in[ at + b ] ) ) << ( 8 * b );
+    }
+    return value;
+}
+
+std::string profile::header( int64_t word ) const {
+    std::string result( magic, sizeof( magic ) );
+    put( result, counters, 4 );
+    put( result, word, 4 );
+    return result;
+}
+
+bool profile::read( const std::string& path, int64_t word ){
+    auto ignore = [ & ]( std::string why ){
+        diagnostics() << "Warning: ignoring profile " << path << ":\n  " << why << '\n';
+        counts.clear();
+        return false;
+    };
+
+    std::ifstream file( path, std::ios::binary );
+    if( !file ){
+        return ignore( "cannot open it" );
+    }
+    std::string data( ( std::istreambuf_iterator< char >( file ) ),
+                      std::istreambuf_iterator< char >() );
+    std::string expected = header( word );
+    if( data.size() < expected.size() || data.compare( 0, sizeof( magic ), expected, 0,
+                                                        sizeof( magic ) ) != 0 ){
+        return ignore( "not a profile" );
+    }
+    if( data.compare( 0, expected.size(), expected ) != 0
+        || data.size() != expected.size() + counters * word )
+    {
+        return ignore( "written by a build of different code or for another target" );
+    }
+
+    counts.resize( counters );
+    for( size_t c = 0; c < counters; ++c ){
+        counts[ c ] = get( data, expected.size() + c * word, word );
+    }
+    return true;
+}
+
+uint64_t profile::entries( key f ) const {
+    return counts.empty() ? 0 : counts[ firsts.at( f ) ];
+}
+
+std::pair< uint64_t, uint64_t > profile::branch( key f, size_t t ) const {
+    if( counts.empty() ){
+        return { 0, 0 };
+    }
+    size_t c = branches.at( { f, t } );
+    return { counts[ c ], counts[ c + 1 ] };
+}
+
+using arg = std::pair< Token, key >;
+
+// the expression f returns, when that is all f does: a single Return of
+// arithmetic over its arguments and literals
+static std::optional< arg > returned( const std::vector< triple >& ts ){
+    std::vector< bool > used( ts.size(), false );
+    for( auto& t : ts ){
+        for( auto [ token, k ] : t.args ){
+            if( token == Token::Expression ){
+                used[ k ] = true;
+            } else if( token != Token::Literal && token != Token::Argument ){
+                return std::nullopt;
+            }
+        }
+    }
+
+    std::optional< arg > result;
+    for( size_t i = 0; i < ts.size(); ++i ){
+        const triple& t = ts[ i ];
+        if( !used[ i ] ){
+            if( result || t.keyword != Keywords::Return || t.args.size() != 1 ){
+                return std::nullopt;
+            }
+            result = t.args[ 0 ];
+        } else if( t.keyword != Keywords::None
+                   || ( t.op != Operators::Intplus && t.op != Operators::Intmin
+                        && t.op != Operators::Intmul && t.op != Operators::Intdiv ) )
+        {
+            return std::nullopt;
+        }
+    }
+    // a lone leaf would leave nothing to put in place of the call
+    if( !result || result->first != Token::Expression ){
+        return std::nullopt;
+    }
+    return result;
+}
+
+static bool calls( const std::vector< triple >& ts, const arg& a ){
+    if( a.first != Token::Expression ){
+        return false;
+    }
+    const triple& t = ts[ a.second ];
+    return t.op == Operators::Call
+        || std::any_of( t.args.begin(), t.args.end(), [ & ]( auto& kid ){
+               return calls( ts, kid ); } );
+}
+
+static void uses( const std::vector< triple >& ts, const arg& a, std::map< key, size_t >& count ){
+    if( a.first == Token::Argument ){
+        ++count[ a.second ];
+    } else if( a.first == Token::Expression ){
+        for( auto& kid : ts[ a.second ].args ){
+            uses( ts, kid, count );
+        }
+    }
+}
+
+// copies the callee's triple t to the end of caller, arguments replaced by actuals
+static arg copy( const std::vector< triple >& callee, const arg& a,
+                 const std::vector< arg >& actuals, std::vector< triple >& caller )
+{
+    if( a.first == Token::Argument ){
+        return actuals[ a.second ];
+    }
+    if( a.first != Token::Expression ){
+        return a;
+    }
+    triple t = callee[ a.second ];
+    for( auto& kid : t.args ){
+        kid = copy( callee, kid, actuals, caller );
+    }
+    t.reused = false;
+    caller.push_back( std::move( t ) );
+    return { Token::Expression, caller.size() - 1 };
+}
+
+void inline_hot_calls( std::map< key, std::vector< triple > >& triples,
+                       const std::vector< function >& functions, const profile& prof )
+{
+    uint64_t hottest = 0;
+    for( auto& [ f, ts ] : triples ){
+        hottest = std::max( hottest, prof.entries( f ) );
+    }
+
+    // only the bodies of functions that are called at least an eighth as often as the hottest
+    std::map< key, arg > bodies;
+    for( auto& [ f, ts ] : triples ){
+        uint64_t n = prof.entries( f );
+        if( n && n * 8 >= hottest && functions[ f ].name != "main" ){
+            if( auto body = returned( ts ) ){
+                bodies[ f ] = *body;
+            }
+        }
+    }
+
+    for( auto& [ f, ts ] : triples ){
+        std::vector< bool > used( ts.size(), false );
+        for( auto& t : ts ){
+            for( auto [ token, k ] : t.args ){
+                if( token == Token::Expression ){
+                    used[ k ] = true;
+                }
+            }
+        }
+
+        size_t original = ts.size();
+        for( size_t j = 0; j < original; ++j ){
+            if( !used[ j ] || ts[ j ].op != Operators::Call ){
+                continue;
+            }
+            key g = ts[ j ].args[ 0 ].second;
+            auto body = bodies.find( g );
+            if( body == bodies.end() || g == f ){
+                continue;
+            }
+
+            std::vector< arg > actuals;
+            for( size_t i = 1; i < ts[ j ].args.size(); ++i ){
+                if( ts[ j ].args[ i ].first != Token::None ){
+                    actuals.push_back( ts[ j ].args[ i ] );
+                }
+            }
+            if( actuals.size() != functions[ g ].arguments.size() ){
+                continue;
+            }
+
+            // the actuals must stay free of side effects and be computed only once
+            const std::vector< triple >& callee = triples.at( g );
+            std::map< key, size_t > count;
+            uses( callee, body->second, count );
+            bool safe = true;
+            for( size_t a = 0; a < actuals.size(); ++a ){
+                safe = safe && !calls( ts, actuals[ a ] )
+                    && ( actuals[ a ].first != Token::Expression || count[ a ] <= 1 );
+            }
+            if( !safe ){
+                continue;
+            }
+
+            triple root = callee[ body->second.second ];
+            for( auto& kid : root.args ){
+                kid = copy( callee, kid, actuals, ts );
+            }
+            root.reused = ts[ j ].reused;
+            ts[ j ] = std::move( root );
+        }
+    }
+}
+
+static bool is_jump( const instruction& i ){
+    return i.op == Opcode::Je || i.op == Opcode::Jne || i.op == Opcode::Jae
+        || i.op == Opcode::Jmp;
+}
+
+void move_cold_blocks( std::vector< instruction >& code,
+                       const std::map< size_t, std::string >& branch_labels,
+                       key f, const profile& prof )
+{
+    for( auto& [ t, lbl ] : branch_labels ){
+        // appended code must not be reachable by falling off the end
+        if( code.empty() || ( code.back().op != Opcode::Ret && code.back().op != Opcode::Jmp ) ){
+            return;
+        }
+        auto [ runs, through ] = prof.branch( f, t );
+        if( runs == 0 || through * 8 >= runs ){
+            continue;
+        }
+
+        auto target = [ & ]( const instruction& i ){
+            return is_jump( i ) && i.operands[ 0 ].symbol == lbl;
+        };
+        if( std::count_if( code.begin(), code.end(), target ) != 1 ){
+            continue;
+        }
+        size_t jump = std::find_if( code.begin(), code.end(), target ) - code.begin();
+        size_t end = std::find( code.begin() + jump, code.end(), label( lbl ) ) - code.begin();
+        if( code[ jump ].op != Opcode::Je || end == code.size() ){
+            continue;
+        }
+
+        // labels inside the block may only be jumped to from inside it
+        bool closed = true;
+        for( size_t i = jump + 1; i < end && closed; ++i ){
+            if( code[ i ].op != Opcode::Label ){
+                continue;
+            }
+            const std::string& name = code[ i ].operands[ 0 ].symbol;
+            for( size_t k = 0; k < code.size(); ++k ){
+                if( ( k <= jump || k >= end ) && is_jump( code[ k ] )
+                    && code[ k ].operands[ 0 ].symbol == name )
+                {
+                    closed = false;
+                }
+            }
+        }
+        if( !closed ){
+            continue;
+        }
+
+        std::string cold = lbl + "_cold";
+        std::vector< instruction > block( code.begin() + jump + 1, code.begin() + end );
+        code.erase( code.begin() + jump + 1, code.begin() + end );
+        code[ jump ] = { Opcode::Jne, { operand::sym( cold ) } };
+        code.push_back( label( cold ) );
+        code.insert( code.end(), block.begin(), block.end() );
+        code.push_back( { Opcode::Jmp, { operand::sym( lbl ) } } );
+    }
+}
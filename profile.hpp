@@ -0,0 +1,53 @@
+#pragma once
+
+#include "instruction.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* The counters of a --profile-generate build.
+ *
+ * Every function has one counter for its entries, followed by two for each of
+ * its Ifjumps: how often it ran and how often it fell through into its block.
+ * They are numbered over the functions in key order, so a build of the same
+ * source numbers them the same way. The instrumented program writes a 16-byte
+ * header followed by the counters, each a word wide.
+ */
+class profile {
+  public:
+    explicit profile( const std::map< key, std::vector< triple > >& triples );
+
+    size_t size() const { return counters; }
+    size_t first( key f ) const { return firsts.at( f ); }
+
+    std::string header( int64_t word ) const;
+
+    // false, with a warning, when path cannot be read or was written for other code
+    bool read( const std::string& path, int64_t word );
+
+    uint64_t entries( key f ) const;
+    // executions and fall-throughs of the Ifjump at triple t of f
+    std::pair< uint64_t, uint64_t > branch( key f, size_t t ) const;
+
+  private:
+    size_t counters = 0;
+    std::map< key, size_t > firsts;
+    std::map< std::pair< key, size_t >, size_t > branches;
+    std::vector< uint64_t > counts;
+};
+
+// Replaces calls to hot functions that only return an arithmetic expression of
+// their arguments by that expression.
+void inline_hot_calls( std::map< key, std::vector< triple > >& triples,
+                       const std::vector< function >& functions, const profile& prof );
+
+// Moves the blocks of Ifjumps that rarely fall through behind the function's
+// last instruction, so the hot path runs straight on.
+void move_cold_blocks( std::vector< instruction >& code,
+                       const std::map< size_t, std::string >& branch_labels,
+                       key f, const profile& prof );
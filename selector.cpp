@@ -0,0 +1,507 @@
+#include "selector.hpp"
+#include "diagnostics.hpp"
+#include "target.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+using Nt = selector::Nt;
+
+static const operand eax = operand::r( Reg::Ax );
+static const operand ebx = operand::r( Reg::Bx );
+static const operand edx = operand::r( Reg::Dx );
+
+// Arithmetic wraps at the word size; results that do not fit an instruction's
+// 32-bit immediate are left for run time.
+static std::optional< int64_t > fold( Operators op, int64_t a, int64_t b, int64_t word ){
+    uint64_t mask = word == 8 ? ~uint64_t( 0 ) : 0xffffffff;
+    uint64_t x = uint64_t( a ) & mask, y = uint64_t( b ) & mask;
+    uint64_t result;
+    switch( op ){
+        case Operators::Intplus:
+            result = x + y;
+            break;
+        case Operators::Intmin:
+            result = x - y;
+            break;
+        case Operators::Intmul:
+            result = x * y;
+            break;
+        case Operators::Intdiv:
+            // div is unsigned
+            if( y == 0 ){
+                return std::nullopt;
+            }
+            result = x / y;
+            break;
+        default:
+            return std::nullopt;
+    }
+    int64_t value = word == 8 ? int64_t( result ) : int64_t( int32_t( result ) );
+    if( value < INT32_MIN || value > INT32_MAX ){
+        return std::nullopt;
+    }
+    return value;
+}
+
+static int log2_exact( int64_t v ){
+    for( int shift = 0; shift < 32; ++shift ){
+        if( v == ( int64_t( 1 ) << shift ) ){
+            return shift;
+        }
+    }
+    return -1;
+}
+
+selector::pattern selector::op( Operators o, std::vector< pattern > kids ){
+    pattern p;
+    p.op = o;
+    p.kids = std::move( kids );
+    return p;
+}
+
+selector::pattern selector::kw( Keywords k, std::vector< pattern > kids ){
+    pattern p;
+    p.keyword = k;
+    p.kids = std::move( kids );
+    return p;
+}
+
+selector::pattern selector::leaf( Token t ){
+    pattern p;
+    p.leaf = t;
+    return p;
+}
+
+selector::selector( const target& arch,
+                    const std::vector< function >& functions,
+                    const std::vector< int64_t >& integers,
+                    const std::vector< std::string >& strings,
+                    key fkey )
+    : arch( arch ), functions( functions ), integers( integers ), strings( strings ),
+      fkey( fkey )
+{
+    available = arch.temporaries();
+}
+
+const std::vector< selector::rule >& selector::rules(){
+    using enum Nt;
+    using enum Opcode;
+    using O = Operators;
+    using K = Keywords;
+
+    const pattern R{ Reg }, I{ Imm }, M{ Mem };
+
+    // a Mul whose factor lea can encode
+    static auto scaled = []( selector& s, tree& n ){
+        auto c = s.constant( *n.kids[ 1 ] );
+        return c && ( *c == 2 || *c == 3 || *c == 4 || *c == 5 || *c == 8 || *c == 9 );
+    };
+    static auto lea = []( selector& s, tree& mul, int64_t disp ){
+        int64_t factor = *s.constant( *mul.kids[ 1 ] );
+        s.reduce( *mul.kids[ 0 ], Reg );
+        operand address = factor % 2
+            ? operand::mem( Reg::Ax, disp, Reg::Ax, factor - 1 )
+            : operand::mem( Reg::None, disp, Reg::Ax, factor );
+        s.emit( Lea, { address, eax } );
+        return eax;
+    };
+    static auto foldable = []( selector& s, tree& n ){
+        return s.constant( n ).has_value();
+    };
+    static auto folded = []( selector& s, tree& n ){
+        return operand::imm( *s.constant( n ) );
+    };
+
+    static const std::vector< rule > table = {
+        // leaves and chain rules
+        { Imm, leaf( Token::Literal ), 0, nullptr, folded },
+        { Mem, leaf( Token::Identifier ), 0, nullptr, []( selector& s, tree& n ){
+            return s.memory( n ); } },
+        { Mem, leaf( Token::Argument ), 0, nullptr, []( selector& s, tree& n ){
+            return s.memory( n ); } },
+        { Reg, I, 1, nullptr, []( selector& s, tree& n ){
+            s.emit( Mov, { s.reduce( n, Imm ), eax } );
+            return eax; } },
+        { Reg, M, 1, nullptr, []( selector& s, tree& n ){
+            s.emit( Mov, { s.reduce( n, Mem ), eax } );
+            return eax; } },
+        { Arg, leaf( Token::None ), 0, nullptr, []( selector&, tree& ){
+            return operand(); } },
+        { Arg, I, 1, nullptr, []( selector& s, tree& n ){
+            operand o = s.reduce( n, Imm );
+            s.push( o );
+            return o; } },
+        { Arg, M, 1, nullptr, []( selector& s, tree& n ){
+            operand o = s.reduce( n, Mem );
+            s.push( o );
+            return o; } },
+        { Arg, R, 1, nullptr, []( selector& s, tree& n ){
+            s.reduce( n, Reg );
+            s.push( eax );
+            return eax; } },
+        { Stmt, R, 0, nullptr, []( selector& s, tree& n ){
+            s.reduce( n, Reg );
+            return operand(); } },
+
+        // constant folding
+        { Imm, op( O::Intplus, { I, I } ), 0, foldable, folded },
+        { Imm, op( O::Intmin, { I, I } ), 0, foldable, folded },
+        { Imm, op( O::Intmul, { I, I } ), 0, foldable, folded },
+        { Imm, op( O::Intdiv, { I, I } ), 0, foldable, folded },
+
+        // addition
+        { Reg, op( O::Intplus, { R, I } ), 1, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            s.emit( Add, { s.reduce( *n.kids[ 1 ], Imm ), eax } );
+            return eax; } },
+        { Reg, op( O::Intplus, { I, R } ), 1, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 1 ], Reg );
+            s.emit( Add, { s.reduce( *n.kids[ 0 ], Imm ), eax } );
+            return eax; } },
+        { Reg, op( O::Intplus, { R, M } ), 1, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            s.emit( Add, { s.reduce( *n.kids[ 1 ], Mem ), eax } );
+            return eax; } },
+        { Reg, op( O::Intplus, { M, R } ), 1, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 1 ], Reg );
+            s.emit( Add, { s.reduce( *n.kids[ 0 ], Mem ), eax } );
+            return eax; } },
+        { Reg, op( O::Intplus, { op( O::Intmul, { R, I } ), I } ), 1, []( selector& s, tree& n ){
+            return scaled( s, *n.kids[ 0 ] ); }, []( selector& s, tree& n ){
+            return lea( s, *n.kids[ 0 ], *s.constant( *n.kids[ 1 ] ) ); } },
+        { Reg, op( O::Intplus, { I, op( O::Intmul, { R, I } ) } ), 1, []( selector& s, tree& n ){
+            return scaled( s, *n.kids[ 1 ] ); }, []( selector& s, tree& n ){
+            return lea( s, *n.kids[ 1 ], *s.constant( *n.kids[ 0 ] ) ); } },
+        { Reg, op( O::Intplus, { R, R } ), 4, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            operand left = s.save();
+            s.reduce( *n.kids[ 1 ], Reg );
+            s.emit( Add, { s.restore( left, Reg::Dx ), eax } );
+            return eax; } },
+
+        // subtraction
+        { Reg, op( O::Intmin, { R, I } ), 1, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            s.emit( Sub, { s.reduce( *n.kids[ 1 ], Imm ), eax } );
+            return eax; } },
+        { Reg, op( O::Intmin, { R, M } ), 1, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            s.emit( Sub, { s.reduce( *n.kids[ 1 ], Mem ), eax } );
+            return eax; } },
+        { Reg, op( O::Intmin, { I, R } ), 2, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 1 ], Reg );
+            s.emit( Neg, { eax } );
+            s.emit( Add, { s.reduce( *n.kids[ 0 ], Imm ), eax } );
+            return eax; } },
+        { Reg, op( O::Intmin, { M, R } ), 2, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 1 ], Reg );
+            s.emit( Neg, { eax } );
+            s.emit( Add, { s.reduce( *n.kids[ 0 ], Mem ), eax } );
+            return eax; } },
+        { Reg, op( O::Intmin, { R, R } ), 5, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            operand left = s.save();
+            s.reduce( *n.kids[ 1 ], Reg );
+            s.emit( Mov, { eax, edx } );
+            s.restore_into( left, Reg::Ax );
+            s.emit( Sub, { edx, eax } );
+            return eax; } },
+
+        // multiplication
+        { Reg, op( O::Intmul, { R, I } ), 1, scaled, []( selector& s, tree& n ){
+            return lea( s, n, 0 ); } },
+        { Reg, op( O::Intmul, { R, I } ), 2, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            s.emit( Imul, { s.reduce( *n.kids[ 1 ], Imm ), eax, eax } );
+            return eax; } },
+        { Reg, op( O::Intmul, { I, R } ), 2, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 1 ], Reg );
+            s.emit( Imul, { s.reduce( *n.kids[ 0 ], Imm ), eax, eax } );
+            return eax; } },
+        { Reg, op( O::Intmul, { R, M } ), 2, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            s.emit( Imul, { s.reduce( *n.kids[ 1 ], Mem ), eax } );
+            return eax; } },
+        { Reg, op( O::Intmul, { M, R } ), 2, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 1 ], Reg );
+            s.emit( Imul, { s.reduce( *n.kids[ 0 ], Mem ), eax } );
+            return eax; } },
+        { Reg, op( O::Intmul, { R, R } ), 5, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            operand left = s.save();
+            s.reduce( *n.kids[ 1 ], Reg );
+            s.emit( Imul, { s.restore( left, Reg::Dx ), eax } );
+            return eax; } },
+
+        // unsigned division
+        { Reg, op( O::Intdiv, { R, I } ), 1, []( selector& s, tree& n ){
+            return log2_exact( *s.constant( *n.kids[ 1 ] ) ) >= 0; }, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            s.emit( Shr, { operand::imm( log2_exact( *s.constant( *n.kids[ 1 ] ) ) ), eax } );
+            return eax; } },
+        { Reg, op( O::Intdiv, { R, I } ), 3, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            s.emit( Mov, { s.reduce( *n.kids[ 1 ], Imm ), ebx } );
+            s.emit( Xor, { edx, edx } );
+            s.emit( Div, { ebx } );
+            return eax; } },
+        { Reg, op( O::Intdiv, { R, M } ), 2, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            s.emit( Xor, { edx, edx } );
+            s.emit( Div, { s.reduce( *n.kids[ 1 ], Mem ) } );
+            return eax; } },
+        { Reg, op( O::Intdiv, { R, R } ), 6, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            operand left = s.save();
+            s.reduce( *n.kids[ 1 ], Reg );
+            s.emit( Mov, { eax, ebx } );
+            s.restore_into( left, Reg::Ax );
+            s.emit( Xor, { edx, edx } );
+            s.emit( Div, { ebx } );
+            return eax; } },
+
+        // statements
+        { Stmt, op( O::Equals, { M, I } ), 1, nullptr, []( selector& s, tree& n ){
+            s.emit( Mov, { s.reduce( *n.kids[ 1 ], Imm ), s.reduce( *n.kids[ 0 ], Mem ) } );
+            return operand(); } },
+        { Stmt, op( O::Equals, { M, R } ), 1, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 1 ], Reg );
+            s.emit( Mov, { eax, s.reduce( *n.kids[ 0 ], Mem ) } );
+            return operand(); } },
+        { Stmt, kw( K::Ifjump, { I } ), 0, nullptr, []( selector& s, tree& n ){
+            if( *s.constant( *n.kids[ 0 ] ) == 0 ){
+                s.emit( Jmp, { operand::sym( s.branch_label() ) } );
+            }
+            return operand(); } },
+        { Stmt, kw( K::Ifjump, { M } ), 2, nullptr, []( selector& s, tree& n ){
+            s.emit( Cmp, { operand::imm( 0 ), s.reduce( *n.kids[ 0 ], Mem ) } );
+            s.emit( Je, { operand::sym( s.branch_label() ) } );
+            return operand(); } },
+        { Stmt, kw( K::Ifjump, { R } ), 2, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            s.emit( Test, { eax, eax } );
+            s.emit( Je, { operand::sym( s.branch_label() ) } );
+            return operand(); } },
+        { Stmt, kw( K::Label, {} ), 0, nullptr, []( selector& s, tree& ){
+            s.emit( ::label( s.branch_label() ) );
+            ++s.lbl;
+            return operand(); } },
+    };
+    return table;
+}
+
+std::vector< instruction > selector::select( const std::vector< triple >& triples ){
+    size_t leaves = 0;
+    for( auto& t : triples ){
+        leaves += t.args.size();
+    }
+    // kids point into nodes, so it must never reallocate
+    nodes.assign( triples.size(), {} );
+    nodes.reserve( triples.size() + leaves );
+
+    std::vector< bool > used( triples.size(), false );
+    for( size_t i = 0; i < triples.size(); ++i ){
+        nodes[ i ].token = Token::Expression;
+        nodes[ i ].t = &triples[ i ];
+        for( auto [ token, k ] : triples[ i ].args ){
+            if( token == Token::Expression ){
+                nodes[ i ].kids.push_back( &nodes[ k ] );
+                used[ k ] = true;
+            } else {
+                tree& leaf = nodes.emplace_back();
+                leaf.token = token;
+                leaf.k = k;
+                nodes[ i ].kids.push_back( &leaf );
+            }
+        }
+    }
+    for( auto& n : nodes ){
+        if( n.token != Token::Expression ){
+            label( n );
+        }
+    }
+    for( size_t i = 0; i < triples.size(); ++i ){
+        label( nodes[ i ] );
+    }
+
+    code.clear();
+    branches.clear();
+    depth = 0;
+    declared = 0;
+    size_t counter = counters.value_or( 0 );
+    if( counters ){
+        count( counter++ );
+    }
+    for( size_t i = 0; i < triples.size(); ++i ){
+        if( used[ i ] ){
+            continue;
+        }
+        if( !nodes[ i ].chosen[ size_t( Nt::Stmt ) ] ){
+            diagnostics() << "Error in function " << functions[ fkey ].name
+                      << ":\n  no instruction pattern covers statement " << i << '\n';
+            throw std::invalid_argument( "no instruction pattern" );
+        }
+        bool branch = triples[ i ].keyword == Keywords::Ifjump;
+        if( branch ){
+            branches[ i ] = branch_label();
+            if( counters ){
+                count( counter++ );
+            }
+        }
+        reduce( nodes[ i ], Nt::Stmt );
+        if( branch && counters ){
+            count( counter++ );
+        }
+    }
+    return std::move( code );
+}
+
+void selector::label( tree& n ){
+    n.cost.fill( infinite );
+    n.chosen.fill( nullptr );
+
+    auto consider = [ & ]( const rule& r, int c ){
+        if( c >= infinite || ( r.applies && !r.applies( *this, n ) ) ){
+            return false;
+        }
+        size_t nt = size_t( r.result );
+        if( c + r.cost < n.cost[ nt ] ){
+            n.cost[ nt ] = c + r.cost;
+            n.chosen[ nt ] = &r;
+            return true;
+        }
+        return false;
+    };
+
+    for( auto* table : { &rules(), &arch.rules() } ){
+        for( auto& r : *table ){
+            if( !r.shape.nt ){
+                consider( r, match( r.shape, n ) );
+            }
+        }
+    }
+    bool changed = true;
+    while( changed ){
+        changed = false;
+        for( auto* table : { &rules(), &arch.rules() } ){
+            for( auto& r : *table ){
+                if( r.shape.nt ){
+                    changed |= consider( r, n.cost[ size_t( *r.shape.nt ) ] );
+                }
+            }
+        }
+    }
+}
+
+int selector::match( const pattern& p, tree& n ){
+    if( p.nt ){
+        return n.cost[ size_t( *p.nt ) ];
+    }
+    if( p.keyword == Keywords::None && p.op == Operators::None ){
+        return !n.t && n.token == p.leaf ? 0 : infinite;
+    }
+    if( !n.t || n.t->keyword != p.keyword || n.t->op != p.op ){
+        return infinite;
+    }
+    if( p.variadic ? n.kids.size() + 1 < p.kids.size() : n.kids.size() != p.kids.size() ){
+        return infinite;
+    }
+
+    int cost = 0;
+    for( size_t i = 0; i < n.kids.size(); ++i ){
+        cost += match( p.kids[ std::min( i, p.kids.size() - 1 ) ], *n.kids[ i ] );
+        if( cost >= infinite ){
+            return infinite;
+        }
+    }
+    return cost;
+}
+
+operand selector::reduce( tree& n, Nt nt ){
+    return n.chosen[ size_t( nt ) ]->emit( *this, n );
+}
+
+// Both kinds of label are assembler-local and carry the function's name, so
+// functions can be generated independently of each other.
+std::string selector::local_label(){
+    return ".L" + functions[ fkey ].name + "_" + std::to_string( locals++ );
+}
+
+std::string selector::branch_label() const {
+    return ".L" + functions[ fkey ].name + "_if" + std::to_string( lbl );
+}
+
+std::optional< int64_t > selector::constant( tree& n ){
+    if( n.token == Token::Literal ){
+        return integers[ n.k ];
+    }
+    if( !n.t || n.kids.size() != 2 ){
+        return std::nullopt;
+    }
+    auto a = constant( *n.kids[ 0 ] );
+    auto b = constant( *n.kids[ 1 ] );
+    if( !a || !b ){
+        return std::nullopt;
+    }
+    return fold( n.t->op, *a, *b, arch.word() );
+}
+
+operand selector::memory( tree& n ){
+    return arch.variable( *this, n.token, n.k );
+}
+
+void selector::emit( Opcode op, std::vector< operand > operands ){
+    code.emplace_back( op, std::move( operands ) );
+}
+
+void selector::emit( instruction i ){
+    code.push_back( std::move( i ) );
+}
+
+void selector::count( size_t counter ){
+    operand slot = operand::mem( "__profile_counters" );
+    slot.value = int64_t( counter ) * arch.word();
+    emit( Opcode::Add, { operand::imm( 1 ), slot } );
+}
+
+void selector::push( operand o ){
+    emit( Opcode::Push, { o } );
+    depth += arch.word();
+}
+
+void selector::pop( operand o ){
+    emit( Opcode::Pop, { o } );
+    depth -= arch.word();
+}
+
+operand selector::save(){
+    if( available.empty() ){
+        push( eax );
+        return {};
+    }
+    Reg r = available.back();
+    available.pop_back();
+    if( std::find( saved.begin(), saved.end(), r ) == saved.end() ){
+        saved.push_back( r );
+    }
+    emit( Opcode::Mov, { eax, operand::r( r ) } );
+    return operand::r( r );
+}
+
+operand selector::restore( operand kept, Reg scratch ){
+    if( kept.kind == operand::Kind::Register ){
+        available.push_back( kept.reg );
+        return kept;
+    }
+    pop( operand::r( scratch ) );
+    return operand::r( scratch );
+}
+
+void selector::restore_into( operand kept, Reg r ){
+    operand value = restore( kept, r );
+    if( !value.is_reg( r ) ){
+        emit( Opcode::Mov, { value, operand::r( r ) } );
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "instruction.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+
+#include <array>
+#include <climits>
+#include <map>
+#include <optional>
+#include <vector>
+
+class target;
+
+/* Tree-pattern instruction selection in the style of BURS.
+ *
+ * The triples of a function are reassembled into expression trees. Every node
+ * is labelled bottom-up with the cheapest rule deriving each nonterminal, then
+ * the trees are reduced top-down from their statement roots, the chosen rules
+ * emitting instructions as they go:
+ *
+ *   Reg  - the value is in the accumulator
+ *   Imm  - the value is a compile-time constant
+ *   Mem  - the value is a variable or an argument in the frame
+ *   Arg  - the value has been pushed
+ *   Stmt - the tree has been executed for its effect
+ *
+ * Arithmetic is shared by all targets; calls, returns, declarations and
+ * output come from the target's own rules.
+ */
+class selector {
+  public:
+    enum class Nt {
+        Reg,
+        Imm,
+        Mem,
+        Arg,
+        Stmt
+    };
+
+    static constexpr size_t nonterminals = 5;
+    static constexpr int infinite = INT_MAX / 2;
+
+    struct rule;
+
+    struct tree {
+        Token token = Token::None;      // Expression for inner nodes
+        key k = 0;
+        const triple* t = nullptr;
+        std::vector< tree* > kids;
+
+        std::array< int, nonterminals > cost;
+        std::array< const rule*, nonterminals > chosen;
+    };
+
+    struct pattern {
+        std::optional< Nt > nt;         // matches anything derivable as nt
+        Token leaf = Token::None;
+        Keywords keyword = Keywords::None;
+        Operators op = Operators::None;
+        std::vector< pattern > kids = {};
+        bool variadic = false;          // the last kid repeats
+    };
+
+    struct rule {
+        Nt result;
+        pattern shape;
+        int cost;
+        bool ( *applies )( selector&, tree& );
+        operand ( *emit )( selector&, tree& );
+    };
+
+    static pattern op( Operators o, std::vector< pattern > kids );
+    static pattern kw( Keywords k, std::vector< pattern > kids );
+    static pattern leaf( Token t );
+
+    selector( const target& arch,
+              const std::vector< function >& functions,
+              const std::vector< int64_t >& integers,
+              const std::vector< std::string >& strings,
+              key fkey );
+
+    std::vector< instruction > select( const std::vector< triple >& triples );
+
+    // temporaries that were handed out and must survive calls
+    const std::vector< Reg >& saved_registers() const { return saved; }
+
+    // the label each Ifjump statement jumps to when its condition is zero
+    const std::map< size_t, std::string >& branch_labels() const { return branches; }
+
+    // When set, select() counts the function's entry in this profile counter
+    // and each Ifjump's executions and fall-throughs in the ones after it.
+    std::optional< size_t > counters;
+
+    // used by the rules
+    const target& arch;
+    const std::vector< function >& functions;
+    const std::vector< int64_t >& integers;
+    const std::vector< std::string >& strings;
+    key fkey;
+
+    size_t lbl = 0;         // Label statements reduced so far
+
+    int64_t depth = 0;      // bytes pushed since the return address
+    size_t declared = 0;    // variables declared so far
+
+    operand reduce( tree& n, Nt nt );
+    std::string local_label();
+    // where the Ifjumps before the next Label jump to
+    std::string branch_label() const;
+    std::optional< int64_t > constant( tree& n );
+    operand memory( tree& n );
+
+    void emit( Opcode op, std::vector< operand > operands = {} );
+    void count( size_t counter );
+    void emit( instruction i );
+    void push( operand o );
+    void pop( operand o );
+
+    // keeps the accumulator aside while another subtree is evaluated
+    operand save();
+    operand restore( operand kept, Reg scratch );
+    void restore_into( operand kept, Reg r );
+
+  private:
+    static const std::vector< rule >& rules();
+
+    std::vector< tree > nodes;
+    std::vector< instruction > code;
+    std::vector< Reg > available;
+    std::vector< Reg > saved;
+    std::map< size_t, std::string > branches;
+    size_t locals = 0;
+
+    void label( tree& n );
+    int match( const pattern& p, tree& n );
+};
@@ -0,0 +1,332 @@
+#include "server.hpp"
+#include "diagnostics.hpp"
+#include "elf.hpp"
+#include "target.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// Anything larger is refused, so one client cannot make the server hold
+// unbounded amounts of memory.
+const size_t max_header = 1024;
+const size_t max_source = size_t( 64 ) << 20;
+// Requests read but not yet compiled; readers wait while it is full.
+const size_t max_queued = 256;
+
+// One client: requests are read from in and answers written to out.
+class connection {
+    int in;
+    int out;
+    bool owned;
+
+    std::string buffer;
+    size_t at = 0;
+    std::mutex writing;
+
+    // reads more into the buffer; false at the end of input
+    bool fill(){
+        buffer.erase( 0, at );
+        at = 0;
+        char chunk[ 1 << 16 ];
+        ssize_t n;
+        do {
+            n = ::read( in, chunk, sizeof( chunk ) );
+        } while( n < 0 && errno == EINTR );
+        if( n <= 0 ){
+            return false;
+        }
+        buffer.append( chunk, n );
+        return true;
+    }
+
+  public:
+    connection( int in, int out, bool owned ) : in( in ), out( out ), owned( owned ) {}
+    ~connection(){
+        if( owned ){
+            ::close( in );
+        }
+    }
+
+    connection( const connection& ) = delete;
+    connection& operator=( const connection& ) = delete;
+
+    // a line without its '\n', or more than limit bytes without finding one
+    bool line( std::string& result, size_t limit ){
+        size_t end;
+        while( ( end = buffer.find( '\n', at ) ) == std::string::npos ){
+            if( buffer.size() - at > limit ){
+                result = buffer.substr( at );
+                at = buffer.size();
+                return true;
+            }
+            if( !fill() ){
+                return false;
+            }
+        }
+        result = buffer.substr( at, end - at );
+        at = end + 1;
+        return true;
+    }
+
+    bool bytes( size_t count, std::string& result ){
+        while( buffer.size() - at < count ){
+            if( !fill() ){
+                return false;
+            }
+        }
+        result = buffer.substr( at, count );
+        at += count;
+        return true;
+    }
+
+    // makes reads return the end of input, so its reader stops
+    void hang_up(){
+        ::shutdown( in, SHUT_RDWR );
+    }
+
+    // whole answers at a time, as several workers may answer at once
+    void send( const std::string& data ){
+        std::lock_guard< std::mutex > lock( writing );
+        for( size_t done = 0; done < data.size(); ){
+            ssize_t n = ::write( out, data.data() + done, data.size() - done );
+            if( n < 0 && errno == EINTR ){
+                continue;
+            }
+            if( n <= 0 ){
+                return;
+            }
+            done += n;
+        }
+    }
+};
+
+struct request {
+    std::shared_ptr< connection > from = nullptr;
+    std::string id = "";
+    std::string source = "";
+    options opts = {};
+    bool executable = false;
+};
+
+class request_queue {
+    std::mutex lock;
+    std::condition_variable ready;
+    std::condition_variable room;
+    std::deque< request > requests;
+    bool closed = false;
+
+  public:
+    // waits while max_queued requests are waiting already
+    void push( request r ){
+        {
+            std::unique_lock< std::mutex > hold( lock );
+            room.wait( hold, [ & ]{ return requests.size() < max_queued; } );
+            requests.push_back( std::move( r ) );
+        }
+        ready.notify_one();
+    }
+
+    // the next request; none once the queue is closed and empty
+    std::optional< request > pop(){
+        std::unique_lock< std::mutex > hold( lock );
+        ready.wait( hold, [ & ]{ return closed || !requests.empty(); } );
+        if( requests.empty() ){
+            return std::nullopt;
+        }
+        request r = std::move( requests.front() );
+        requests.pop_front();
+        room.notify_one();
+        return r;
+    }
+
+    void close(){
+        {
+            std::lock_guard< std::mutex > hold( lock );
+            closed = true;
+        }
+        ready.notify_all();
+    }
+};
+
+}
+
+static void answer( request& r ){
+    std::ostringstream log;
+    std::string output;
+    int status = 0;
+    {
+        collect_diagnostics collect( log );
+        try {
+            parser p( r.opts );
+            p.parse_source( std::move( r.source ) );
+            program compiled = p.compile();
+            output = r.executable ? executable( compiled ) : to_string( compiled );
+        } catch( std::invalid_argument& e ){
+            status = 1;
+            output.clear();
+        } catch( std::exception& e ){
+            // e.g. std::bad_alloc, which the parser does not report itself
+            diagnostics() << "Error:\n  " << e.what() << '\n';
+            status = 1;
+            output.clear();
+        } catch( ... ){
+            diagnostics() << "Error:\n  unknown failure\n";
+            status = 1;
+            output.clear();
+        }
+    }
+    std::string diagnostics = log.str();
+    r.from->send( "result " + r.id + " " + std::to_string( status ) + " "
+                  + std::to_string( output.size() ) + " " + std::to_string( diagnostics.size() )
+                  + "\n" + output + diagnostics );
+}
+
+// reads the requests of c into queue until it ends or sends a malformed header
+static void receive( std::shared_ptr< connection > c, request_queue& queue,
+                     const options& defaults )
+{
+    std::string header;
+    while( c->line( header, max_header ) ){
+        request r{ c };
+        r.opts = defaults;
+        r.opts.jobs = 1;
+
+        std::istringstream words( header );
+        std::string command;
+        size_t length = 0;
+        words >> command >> r.id >> length;
+        std::string bad;
+        if( header.size() > max_header ){
+            bad = "header longer than " + std::to_string( max_header ) + " bytes";
+        } else if( !words || command != "compile" ){
+            bad = "expected compile <id> <length>";
+        } else if( length > max_source ){
+            bad = "source longer than " + std::to_string( max_source ) + " bytes";
+        }
+        for( std::string word; bad.empty() && words >> word; ){
+            if( word == "asm" || word == "exe" ){
+                r.executable = word == "exe";
+            } else if( word == "-O" ){
+                r.opts.optimize = true;
+            } else if( word == "-t" ){
+                if( !( words >> r.opts.target ) || !make_target( r.opts.target ) ){
+                    bad = "unknown target " + r.opts.target;
+                }
+            } else {
+                bad = "unknown option " + word;
+            }
+        }
+        if( !bad.empty() ){
+            c->send( "error " + bad + "\n" );
+            c->hang_up();
+            return;
+        }
+
+        if( !c->bytes( length, r.source ) ){
+            return;
+        }
+        queue.push( std::move( r ) );
+    }
+}
+
+int serve( const options& defaults, const std::string& socket ){
+    // a client that goes away must not take the server with it
+    std::signal( SIGPIPE, SIG_IGN );
+
+    request_queue queue;
+    std::vector< std::thread > workers;
+    for( size_t w = 0; w < std::max< size_t >( 1, defaults.jobs ); ++w ){
+        workers.emplace_back( [ & ]{
+            while( auto r = queue.pop() ){
+                answer( *r );
+            }
+        } );
+    }
+    auto finish = [ & ]( int status ){
+        queue.close();
+        for( auto& w : workers ){
+            w.join();
+        }
+        return status;
+    };
+
+    if( socket.empty() ){
+        receive( std::make_shared< connection >( 0, 1, false ), queue, defaults );
+        return finish( 0 );
+    }
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if( socket.size() >= sizeof( address.sun_path ) ){
+        std::cerr << "Error in --server:\n  socket path too long: " << socket << '\n';
+        return finish( 1 );
+    }
+    std::strcpy( address.sun_path, socket.c_str() );
+
+    int listener = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+    ::unlink( socket.c_str() );
+    if( listener < 0 || ::bind( listener, (sockaddr*)&address, sizeof( address ) ) != 0
+        || ::listen( listener, 64 ) != 0 )
+    {
+        std::cerr << "Error in --server:\n  cannot listen on " << socket << ": "
+                  << std::strerror( errno ) << '\n';
+        return finish( 1 );
+    }
+
+    // readers use queue, so they are all joined before it goes
+    struct reader {
+        std::shared_ptr< connection > from;
+        std::thread thread;
+        std::shared_ptr< std::atomic< bool > > done = std::make_shared< std::atomic< bool > >();
+    };
+    std::list< reader > readers;
+
+    for( ;; ){
+        int client = ::accept( listener, nullptr, nullptr );
+        if( client < 0 ){
+            if( errno == EINTR || errno == ECONNABORTED ){
+                continue;
+            }
+            std::cerr << "Error in --server:\n  " << std::strerror( errno ) << '\n';
+            ::close( listener );
+            for( auto& r : readers ){
+                r.from->hang_up();
+                r.thread.join();
+            }
+            return finish( 1 );
+        }
+
+        readers.remove_if( []( reader& r ){
+            if( !*r.done ){
+                return false;
+            }
+            r.thread.join();
+            return true;
+        } );
+        reader& r = readers.emplace_back();
+        r.from = std::make_shared< connection >( client, client, true );
+        r.thread = std::thread( [ &queue, &defaults, from = r.from, done = r.done ]{
+            receive( from, queue, defaults );
+            *done = true;
+        } );
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "parser.hpp"
+
+#include <string>
+
+/* Compiles programs sent over a connection, without starting a process or
+ * reading a file for each of them.
+ *
+ * A request is a header line followed by the source it announces:
+ *
+ *     compile <id> <length> [asm | exe] [-O] [-t <target>]
+ *
+ * Every request is answered, once compiled, by a header line followed by the
+ * output and then the diagnostics:
+ *
+ *     result <id> <status> <output length> <diagnostics length>
+ *
+ * The status is 0 when the program compiled and 1 when it did not, whatever
+ * made it fail. The output is the assembly, or with exe the executable.
+ * Options missing from a request are taken from defaults. Up to defaults.jobs
+ * requests, from all connections, are compiled at once, so answers can arrive
+ * out of order; the ids tell them apart. A malformed header is answered by
+ * "error <reason>", and the connection is closed. Headers longer than 1 KiB
+ * and sources longer than 64 MiB count as malformed. Once 256 requests wait
+ * to be compiled, connections are not read until the workers catch up.
+ *
+ * With an empty socket path the only connection is stdin and stdout, and
+ * serve returns once stdin ends and every request is answered. Otherwise it
+ * listens on that Unix domain socket until it fails, then hangs up on every
+ * client and returns once the requests it read are answered.
+ */
+int serve( const options& defaults, const std::string& socket );
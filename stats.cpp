@@ -0,0 +1,160 @@
+#include "stats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+
+#include <sys/resource.h>
+
+statistics::timer::timer( statistics& owner, std::string phase )
+    : owner( owner ), phase( std::move( phase ) ), start( std::chrono::steady_clock::now() ) {}
+
+statistics::timer::~timer(){
+    owner.add_time( phase, std::chrono::duration< double >(
+                               std::chrono::steady_clock::now() - start ).count() );
+}
+
+template< class T >
+static void add_to( std::vector< std::pair< std::string, T > >& list, const std::string& name,
+                    T value )
+{
+    auto found = std::find_if( list.begin(), list.end(), [ & ]( auto& e ){
+        return e.first == name; } );
+    if( found == list.end() ){
+        list.emplace_back( name, value );
+    } else {
+        found->second += value;
+    }
+}
+
+void statistics::add_time( const std::string& phase, double seconds ){
+    add_to( phases, phase, seconds );
+}
+
+void statistics::add( const std::string& name, uint64_t n ){
+    add_to( counts, name, n );
+}
+
+uint64_t statistics::count( const std::string& name ) const {
+    for( auto& [ counted, n ] : counts ){
+        if( counted == name ){
+            return n;
+        }
+    }
+    return 0;
+}
+
+void statistics::merge( const statistics& other ){
+    for( auto& [ phase, seconds ] : other.phases ){
+        add_time( phase, seconds );
+    }
+    for( auto& [ name, n ] : other.counts ){
+        add( name, n );
+    }
+}
+
+void statistics::print( std::ostream& out ) const {
+    size_t width = 0;
+    for( auto& [ phase, seconds ] : phases ){
+        width = std::max( width, phase.size() );
+    }
+    for( auto& [ name, n ] : counts ){
+        width = std::max( width, name.size() );
+    }
+    width = std::max( width, std::string( "allocated bytes" ).size() ) + 2;
+
+    auto flags = out.flags();
+    double total = 0;
+    for( auto& [ phase, seconds ] : phases ){
+        out << std::left << std::setw( width ) << phase << std::right << std::fixed
+            << std::setprecision( 3 ) << std::setw( 10 ) << seconds * 1000 << " ms\n";
+        total += seconds;
+    }
+    out << std::left << std::setw( width ) << "total" << std::right << std::setw( 10 )
+        << total * 1000 << " ms\n\n";
+    out.flags( flags );
+
+    for( auto& [ name, n ] : counts ){
+        out << std::left << std::setw( width ) << name << std::right << std::setw( 10 ) << n
+            << '\n';
+    }
+    out << std::left << std::setw( width ) << "peak RSS" << std::right << std::setw( 10 )
+        << peak_rss() / 1024 << " KiB\n";
+    out << std::left << std::setw( width ) << "allocations" << std::right << std::setw( 10 )
+        << allocations() << '\n';
+    out << std::left << std::setw( width ) << "allocated bytes" << std::right << std::setw( 10 )
+        << allocated_bytes() << '\n';
+    out.flags( flags );
+}
+
+// names are ours, so they never need escaping
+void statistics::print_json( std::ostream& out ) const {
+    auto flags = out.flags();
+    out << "{\n  \"phases\": {";
+    for( size_t i = 0; i < phases.size(); ++i ){
+        out << ( i ? ",\n    \"" : "\n    \"" ) << phases[ i ].first << "\": " << std::fixed
+            << std::setprecision( 9 ) << phases[ i ].second;
+    }
+    out.flags( flags );
+    out << "\n  },\n  \"counts\": {";
+    for( size_t i = 0; i < counts.size(); ++i ){
+        out << ( i ? ",\n    \"" : "\n    \"" ) << counts[ i ].first << "\": " << counts[ i ].second;
+    }
+    out << "\n  },\n  \"memory\": {\n"
+        << "    \"peak_rss_bytes\": " << peak_rss() << ",\n"
+        << "    \"allocations\": " << allocations() << ",\n"
+        << "    \"allocated_bytes\": " << allocated_bytes() << "\n  }\n}\n";
+}
+
+static std::atomic< bool > counting = false;
+static std::atomic< uint64_t > allocation_count = 0;
+static std::atomic< uint64_t > allocation_bytes = 0;
+
+void count_allocations(){
+    counting = true;
+}
+
+uint64_t allocations(){
+    return allocation_count;
+}
+
+uint64_t allocated_bytes(){
+    return allocation_bytes;
+}
+
+uint64_t peak_rss(){
+    rusage usage;
+    if( getrusage( RUSAGE_SELF, &usage ) != 0 ){
+        return 0;
+    }
+    return uint64_t( usage.ru_maxrss ) * 1024;     // reported in KiB on Linux
+}
+
+// The replaceable allocation functions every other form of new and delete
+// ends up in, apart from the over-aligned ones.
+void* operator new( std::size_t size ){
+    if( counting.load( std::memory_order_relaxed ) ){
+        allocation_count.fetch_add( 1, std::memory_order_relaxed );
+        allocation_bytes.fetch_add( size, std::memory_order_relaxed );
+    }
+    for( ;; ){
+        if( void* p = std::malloc( size ? size : 1 ) ){
+            return p;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if( !handler ){
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void operator delete( void* p ) noexcept {
+    std::free( p );
+}
+
+void operator delete( void* p, std::size_t ) noexcept {
+    std::free( p );
+}
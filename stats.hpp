@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* What --stats reports: the wall time spent in each phase and counts of what
+ * the phases made, both in the order they were first recorded, followed by
+ * the memory use of the whole process.
+ */
+class statistics {
+  public:
+    // adds the time from its construction to its destruction to a phase
+    class timer {
+        statistics& owner;
+        std::string phase;
+        std::chrono::steady_clock::time_point start;
+
+      public:
+        timer( statistics& owner, std::string phase );
+        ~timer();
+
+        timer( const timer& ) = delete;
+        timer& operator=( const timer& ) = delete;
+    };
+
+    timer time( std::string phase ) { return timer( *this, std::move( phase ) ); }
+    void add_time( const std::string& phase, double seconds );
+    void add( const std::string& name, uint64_t n );
+    // what add() summed up for name, 0 when nothing was
+    uint64_t count( const std::string& name ) const;
+
+    // adds the times and counts of other, e.g. of another file
+    void merge( const statistics& other );
+
+    void print( std::ostream& out ) const;
+    void print_json( std::ostream& out ) const;
+
+  private:
+    std::vector< std::pair< std::string, double > > phases;
+    std::vector< std::pair< std::string, uint64_t > > counts;
+};
+
+// Starts counting calls to operator new and the bytes they asked for.
+void count_allocations();
+uint64_t allocations();
+uint64_t allocated_bytes();
+
+// The most memory the process has had resident, in bytes.
+uint64_t peak_rss();
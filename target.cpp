@@ -0,0 +1,16 @@
+#include "target.hpp"
+
+std::unique_ptr< target > make_target( std::string name ){
+    if( name == "i386" ){
+        return std::make_unique< target_i386 >();
+    }
+    if( name == "x86-64" || name == "x86_64" ){
+        return std::make_unique< target_x86_64 >();
+    }
+    return nullptr;
+}
+
+std::vector< data_block > target::bss() const {
+    return { { "__outpos", "", size_t( word() ) },
+             { "__outbuf", "", size_t( output_buffer ) } };
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "instruction.hpp"
+#include "lexer.hpp"
+#include "selector.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/* Everything the code generator needs to know about a machine: word size,
+ * where variables live, the calling and syscall conventions (as selection
+ * rules), the function frame and the startup and runtime code.
+ */
+class target {
+  public:
+    // print appends to this buffer, __flush writes it out
+    static constexpr int64_t output_buffer = 4096;
+
+    virtual ~target() = default;
+
+    virtual std::string name() const = 0;
+
+    virtual int64_t word() const = 0;
+
+    // registers the selector may keep values in across calls
+    virtual std::vector< Reg > temporaries() const = 0;
+
+    virtual operand variable( const selector& s, Token token, key k ) const = 0;
+
+    // calls, returns, declarations and output
+    virtual const std::vector< selector::rule >& rules() const = 0;
+
+    // adds the prologue and epilogues around the selected body
+    virtual void frame( const function& f, const std::vector< Reg >& saved,
+                        std::vector< instruction >& code ) const = 0;
+
+    // _start: call _main, flush the output, call __profile when profiling and
+    // exit with main's result
+    virtual std::vector< instruction > entry( bool profile = false ) const = 0;
+
+    // support routines emitted after _start
+    virtual std::vector< instruction > runtime() const = 0;
+
+    // __profile: writes __profile_header and the counters to __profile_path
+    virtual std::vector< instruction > profile_writer( int64_t counters ) const = 0;
+
+    std::vector< data_block > bss() const;
+};
+
+class target_i386 : public target {
+  public:
+    std::string name() const override { return "i386"; }
+    int64_t word() const override { return 4; }
+    std::vector< Reg > temporaries() const override { return {}; }
+    operand variable( const selector& s, Token token, key k ) const override;
+    const std::vector< selector::rule >& rules() const override;
+    // everything lives on the stack, addressed from %esp, so there is no frame to set up
+    void frame( const function&, const std::vector< Reg >&,
+                std::vector< instruction >& ) const override {}
+    std::vector< instruction > entry( bool profile ) const override;
+    std::vector< instruction > runtime() const override;
+    std::vector< instruction > profile_writer( int64_t counters ) const override;
+};
+
+class target_x86_64 : public target {
+  public:
+    std::string name() const override { return "x86-64"; }
+    int64_t word() const override { return 8; }
+    std::vector< Reg > temporaries() const override;
+    operand variable( const selector& s, Token token, key k ) const override;
+    const std::vector< selector::rule >& rules() const override;
+    void frame( const function& f, const std::vector< Reg >& saved,
+                std::vector< instruction >& code ) const override;
+    std::vector< instruction > entry( bool profile ) const override;
+    std::vector< instruction > runtime() const override;
+    std::vector< instruction > profile_writer( int64_t counters ) const override;
+};
+
+// nullptr for an unknown name
+std::unique_ptr< target > make_target( std::string name );
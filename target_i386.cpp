@@ -0,0 +1,156 @@
+#include "target.hpp"
+
+using Nt = selector::Nt;
+
+static const operand eax = operand::r( Reg::Ax );
+static const operand ebx = operand::r( Reg::Bx );
+static const operand ecx = operand::r( Reg::Cx );
+static const operand edx = operand::r( Reg::Dx );
+static const operand esi = operand::r( Reg::Si );
+static const operand edi = operand::r( Reg::Di );
+static const operand esp = operand::r( Reg::Sp );
+
+// Arguments are pushed right to left above the return address, variables are
+// pushed as they are declared and temporaries on top of them.
+operand target_i386::variable( const selector& s, Token token, key k ) const {
+    if( token == Token::Argument ){
+        return operand::mem( Reg::Sp, s.depth + 4 + 4 * k );
+    }
+    return operand::mem( Reg::Sp, s.depth - 4 * ( k + 1 ) );
+}
+
+const std::vector< selector::rule >& target_i386::rules() const {
+    using enum Nt;
+    using enum Opcode;
+    using K = Keywords;
+    using tree = selector::tree;
+
+    const selector::pattern R{ Reg }, A{ Arg };
+    auto call = selector::op( Operators::Call, { selector::leaf( Token::Function ), A } );
+    call.variadic = true;
+
+    static const std::vector< selector::rule > table = {
+        { Reg, call, 2, nullptr, []( selector& s, tree& n ){
+            int64_t pushed = s.depth;
+            for( size_t i = n.kids.size() - 1; i > 0; --i ){
+                s.reduce( *n.kids[ i ], Arg );
+            }
+            pushed = s.depth - pushed;
+            s.emit( Call, { operand::sym( "_" + s.functions[ n.kids[ 0 ]->k ].name ) } );
+            if( pushed ){
+                s.emit( Add, { operand::imm( pushed ), esp } );
+                s.depth -= pushed;
+            }
+            return eax; } },
+        { Stmt, selector::kw( K::Return, { R } ), 2, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            if( s.depth ){
+                s.emit( Add, { operand::imm( s.depth ), esp } );
+            }
+            s.emit( Ret );
+            return operand(); } },
+        { Stmt, selector::kw( K::Declaration, {} ), 1, nullptr, []( selector& s, tree& ){
+            s.push( operand::imm( 0 ) );
+            ++s.declared;
+            return operand(); } },
+        { Stmt, selector::kw( K::Declaration, { A } ), 0, nullptr, []( selector& s, tree& n ){
+            // the pushed value stays on the stack as the variable
+            s.reduce( *n.kids[ 0 ], Arg );
+            ++s.declared;
+            return operand(); } },
+        // constant text is copied into the buffer, or written directly when large
+        { Stmt, selector::kw( K::Print, { selector::leaf( Token::String ) } ), 3, nullptr,
+          []( selector& s, tree& n ){
+            tree& text = *n.kids[ 0 ];
+            s.emit( Mov, { operand::imm( "__str" + std::to_string( text.k ) ), esi } );
+            s.emit( Mov, { operand::imm( s.strings[ text.k ].size() ), ecx } );
+            s.emit( Call, { operand::sym( "__puts" ) } );
+            return operand(); } },
+        // appends the low byte to the output buffer
+        { Stmt, selector::kw( K::Print, { R } ), 7, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            std::string done = s.local_label();
+            s.emit( Mov, { operand::mem( "__outpos" ), ecx } );
+            s.emit( Movb, { eax, operand::mem( "__outbuf", Reg::Cx ) } );
+            s.emit( Add, { operand::imm( 1 ), ecx } );
+            s.emit( Mov, { ecx, operand::mem( "__outpos" ) } );
+            s.emit( Cmp, { operand::imm( output_buffer ), ecx } );
+            s.emit( Jne, { operand::sym( done ) } );
+            s.emit( Call, { operand::sym( "__flush" ) } );
+            s.emit( label( done ) );
+            return operand(); } },
+    };
+    return table;
+}
+
+std::vector< instruction > target_i386::entry( bool profile ) const {
+    using enum Opcode;
+    std::vector< instruction > code = { label( "_start" ),
+                                        { Call, { operand::sym( "_main" ) } },
+                                        { Push, { eax } },
+                                        { Call, { operand::sym( "__flush" ) } } };
+    if( profile ){
+        code.push_back( { Call, { operand::sym( "__profile" ) } } );
+    }
+    code.push_back( { Pop, { ebx } } );
+    code.push_back( { Mov, { operand::imm( 1 ), eax } } );
+    code.push_back( { Int, { operand::imm( 0x80 ) } } );
+    return code;
+}
+
+// __flush: write( 1, __outbuf, __outpos ), clobbers %eax, %ebx, %ecx and %edx
+// __puts: copies %ecx bytes at %esi into the output buffer, clobbers everything
+std::vector< instruction > target_i386::runtime() const {
+    using enum Opcode;
+    return { label( "__flush" ),
+             { Mov, { operand::imm( 4 ), eax } },
+             { Mov, { operand::imm( 1 ), ebx } },
+             { Mov, { operand::imm( "__outbuf" ), ecx } },
+             { Mov, { operand::mem( "__outpos" ), edx } },
+             { Int, { operand::imm( 0x80 ) } },
+             { Mov, { operand::imm( 0 ), operand::mem( "__outpos" ) } },
+             { Ret },
+
+             label( "__puts" ),
+             { Mov, { operand::mem( "__outpos" ), edi } },
+             { Lea, { operand::mem( Reg::Di, 0, Reg::Cx, 1 ), eax } },
+             { Cmp, { operand::imm( output_buffer ), eax } },
+             { Jae, { operand::sym( ".Lputs_direct" ) } },
+             { Add, { operand::imm( "__outbuf" ), edi } },
+             { RepMovsb },
+             { Mov, { eax, operand::mem( "__outpos" ) } },
+             { Ret },
+             label( ".Lputs_direct" ),
+             { Push, { esi } },
+             { Push, { ecx } },
+             { Call, { operand::sym( "__flush" ) } },
+             { Pop, { edx } },
+             { Pop, { ecx } },
+             { Mov, { operand::imm( 4 ), eax } },
+             { Mov, { operand::imm( 1 ), ebx } },
+             { Int, { operand::imm( 0x80 ) } },
+             { Ret } };
+}
+
+// open( __profile_path, O_WRONLY | O_CREAT | O_TRUNC, 0644 ), two writes and close
+std::vector< instruction > target_i386::profile_writer( int64_t counters ) const {
+    using enum Opcode;
+    return { label( "__profile" ),
+             { Mov, { operand::imm( 5 ), eax } },
+             { Mov, { operand::imm( "__profile_path" ), ebx } },
+             { Mov, { operand::imm( 01101 ), ecx } },
+             { Mov, { operand::imm( 0644 ), edx } },
+             { Int, { operand::imm( 0x80 ) } },
+             { Mov, { eax, ebx } },
+             { Mov, { operand::imm( 4 ), eax } },
+             { Mov, { operand::imm( "__profile_header" ), ecx } },
+             { Mov, { operand::imm( 16 ), edx } },
+             { Int, { operand::imm( 0x80 ) } },
+             { Mov, { operand::imm( 4 ), eax } },
+             { Mov, { operand::imm( "__profile_counters" ), ecx } },
+             { Mov, { operand::imm( counters * word() ), edx } },
+             { Int, { operand::imm( 0x80 ) } },
+             { Mov, { operand::imm( 6 ), eax } },
+             { Int, { operand::imm( 0x80 ) } },
+             { Ret } };
+}
@@ -0,0 +1,248 @@
+#include "target.hpp"
+
+#include <algorithm>
+
+using Nt = selector::Nt;
+
+static const operand rax = operand::r( Reg::Ax );
+static const operand rcx = operand::r( Reg::Cx );
+static const operand rdx = operand::r( Reg::Dx );
+static const operand rsi = operand::r( Reg::Si );
+static const operand rdi = operand::r( Reg::Di );
+static const operand rsp = operand::r( Reg::Sp );
+static const operand rbp = operand::r( Reg::Bp );
+
+static const Reg arguments[] = { Reg::Di, Reg::Si, Reg::Dx, Reg::Cx, Reg::R8, Reg::R9 };
+
+static size_t in_registers( const function& f ){
+    return std::min< size_t >( f.arguments.size(), 6 );
+}
+
+std::vector< Reg > target_x86_64::temporaries() const {
+    // callee-saved, handed out from the back
+    return { Reg::R15, Reg::R14, Reg::R13, Reg::R12 };
+}
+
+/* The frame is addressed from %rbp:
+ *
+ *   16(%rbp)...   arguments after the sixth, pushed right to left
+ *   -8(%rbp)...   register arguments, spilled by the prologue
+ *   then          variables, in declaration order
+ *   then          callee-saved temporaries
+ */
+operand target_x86_64::variable( const selector& s, Token token, key k ) const {
+    const function& f = s.functions[ s.fkey ];
+    if( token == Token::Argument ){
+        if( k >= 6 ){
+            return operand::mem( Reg::Bp, 16 + 8 * ( k - 6 ) );
+        }
+        return operand::mem( Reg::Bp, -8 * int64_t( k + 1 ) );
+    }
+    return operand::mem( Reg::Bp, -8 * int64_t( in_registers( f ) + k + 1 ) );
+}
+
+const std::vector< selector::rule >& target_x86_64::rules() const {
+    using enum Nt;
+    using enum Opcode;
+    using K = Keywords;
+    using tree = selector::tree;
+
+    const selector::pattern R{ Reg }, I{ Imm }, A{ Arg };
+    auto call = selector::op( Operators::Call, { selector::leaf( Token::Function ), A } );
+    call.variadic = true;
+
+    static const std::vector< selector::rule > table = {
+        // SysV-like: the first six arguments in registers, the rest on the stack
+        { Reg, call, 2, nullptr, []( selector& s, tree& n ){
+            std::vector< tree* > args;
+            for( size_t i = 1; i < n.kids.size(); ++i ){
+                if( n.kids[ i ]->token != Token::None ){
+                    args.push_back( n.kids[ i ] );
+                }
+            }
+
+            int64_t pushed = s.depth;
+            for( size_t i = args.size(); i > 6; --i ){
+                s.reduce( *args[ i - 1 ], Arg );
+            }
+            pushed = s.depth - pushed;
+
+            // computed arguments first, so that loading the others into
+            // registers cannot be clobbered by a nested call
+            size_t count = std::min< size_t >( args.size(), 6 );
+            std::vector< operand > kept( count );
+            std::vector< bool > simple( count );
+            for( size_t i = 0; i < count; ++i ){
+                simple[ i ] = args[ i ]->cost[ size_t( Imm ) ] < selector::infinite
+                           || args[ i ]->cost[ size_t( Mem ) ] < selector::infinite;
+                if( !simple[ i ] ){
+                    s.reduce( *args[ i ], Reg );
+                    kept[ i ] = s.save();
+                }
+            }
+            for( size_t i = count; i > 0; --i ){
+                if( !simple[ i - 1 ] ){
+                    s.restore_into( kept[ i - 1 ], arguments[ i - 1 ] );
+                }
+            }
+            for( size_t i = 0; i < count; ++i ){
+                if( simple[ i ] ){
+                    Nt nt = args[ i ]->cost[ size_t( Imm ) ] < selector::infinite ? Imm : Mem;
+                    s.emit( Mov, { s.reduce( *args[ i ], nt ), operand::r( arguments[ i ] ) } );
+                }
+            }
+
+            s.emit( Call, { operand::sym( "_" + s.functions[ n.kids[ 0 ]->k ].name ) } );
+            if( pushed ){
+                s.emit( Add, { operand::imm( pushed ), rsp } );
+                s.depth -= pushed;
+            }
+            return rax; } },
+        // frame() puts the epilogue in front of every ret
+        { Stmt, selector::kw( K::Return, { R } ), 1, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            s.emit( Ret );
+            return operand(); } },
+        { Stmt, selector::kw( K::Declaration, {} ), 1, nullptr, []( selector& s, tree& ){
+            s.emit( Mov, { operand::imm( 0 ),
+                           s.arch.variable( s, Token::Identifier, s.declared++ ) } );
+            return operand(); } },
+        { Stmt, selector::kw( K::Declaration, { I } ), 1, nullptr, []( selector& s, tree& n ){
+            s.emit( Mov, { s.reduce( *n.kids[ 0 ], Imm ),
+                           s.arch.variable( s, Token::Identifier, s.declared++ ) } );
+            return operand(); } },
+        { Stmt, selector::kw( K::Declaration, { R } ), 1, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            s.emit( Mov, { rax, s.arch.variable( s, Token::Identifier, s.declared++ ) } );
+            return operand(); } },
+        // constant text is copied into the buffer, or written directly when large
+        { Stmt, selector::kw( K::Print, { selector::leaf( Token::String ) } ), 3, nullptr,
+          []( selector& s, tree& n ){
+            tree& text = *n.kids[ 0 ];
+            s.emit( Mov, { operand::imm( "__str" + std::to_string( text.k ) ), rsi } );
+            s.emit( Mov, { operand::imm( s.strings[ text.k ].size() ), rcx } );
+            s.emit( Call, { operand::sym( "__puts" ) } );
+            return operand(); } },
+        // appends the low byte to the output buffer
+        { Stmt, selector::kw( K::Print, { R } ), 7, nullptr, []( selector& s, tree& n ){
+            s.reduce( *n.kids[ 0 ], Reg );
+            std::string done = s.local_label();
+            s.emit( Mov, { operand::mem( "__outpos" ), rcx } );
+            s.emit( Movb, { rax, operand::mem( "__outbuf", Reg::Cx ) } );
+            s.emit( Add, { operand::imm( 1 ), rcx } );
+            s.emit( Mov, { rcx, operand::mem( "__outpos" ) } );
+            s.emit( Cmp, { operand::imm( output_buffer ), rcx } );
+            s.emit( Jne, { operand::sym( done ) } );
+            s.emit( Call, { operand::sym( "__flush" ) } );
+            s.emit( label( done ) );
+            return operand(); } },
+    };
+    return table;
+}
+
+void target_x86_64::frame( const function& f, const std::vector< Reg >& saved,
+                           std::vector< instruction >& code ) const
+{
+    using enum Opcode;
+    size_t spilled = in_registers( f );
+    size_t slots = spilled + f.variables.size() + saved.size();
+    auto slot = [ & ]( size_t i ){
+        return operand::mem( Reg::Bp, -8 * int64_t( spilled + f.variables.size() + i + 1 ) );
+    };
+
+    std::vector< instruction > result = { { Push, { rbp } }, { Mov, { rsp, rbp } } };
+    if( slots ){
+        result.push_back( { Sub, { operand::imm( ( slots * 8 + 15 ) / 16 * 16 ), rsp } } );
+    }
+    for( size_t k = 0; k < spilled; ++k ){
+        result.push_back( { Mov, { operand::r( arguments[ k ] ),
+                                   operand::mem( Reg::Bp, -8 * int64_t( k + 1 ) ) } } );
+    }
+    for( size_t i = 0; i < saved.size(); ++i ){
+        result.push_back( { Mov, { operand::r( saved[ i ] ), slot( i ) } } );
+    }
+
+    for( auto& i : code ){
+        if( i.op == Ret ){
+            for( size_t r = 0; r < saved.size(); ++r ){
+                result.push_back( { Mov, { slot( r ), operand::r( saved[ r ] ) } } );
+            }
+            result.push_back( { Leave } );
+        }
+        result.push_back( std::move( i ) );
+    }
+    code = std::move( result );
+}
+
+std::vector< instruction > target_x86_64::entry( bool profile ) const {
+    using enum Opcode;
+    std::vector< instruction > code = { label( "_start" ),
+                                        { Call, { operand::sym( "_main" ) } },
+                                        { Push, { rax } },
+                                        { Call, { operand::sym( "__flush" ) } } };
+    if( profile ){
+        code.push_back( { Call, { operand::sym( "__profile" ) } } );
+    }
+    code.push_back( { Pop, { rdi } } );
+    code.push_back( { Mov, { operand::imm( 60 ), rax } } );
+    code.push_back( { Syscall } );
+    return code;
+}
+
+// __flush: write( 1, __outbuf, __outpos ), clobbers %rax, %rcx, %rdx, %rsi, %rdi and %r11
+// __puts: copies %rcx bytes at %rsi into the output buffer, clobbers the same
+std::vector< instruction > target_x86_64::runtime() const {
+    using enum Opcode;
+    return { label( "__flush" ),
+             { Mov, { operand::imm( 1 ), rax } },
+             { Mov, { operand::imm( 1 ), rdi } },
+             { Mov, { operand::imm( "__outbuf" ), rsi } },
+             { Mov, { operand::mem( "__outpos" ), rdx } },
+             { Syscall },
+             { Mov, { operand::imm( 0 ), operand::mem( "__outpos" ) } },
+             { Ret },
+
+             label( "__puts" ),
+             { Mov, { operand::mem( "__outpos" ), rdi } },
+             { Lea, { operand::mem( Reg::Di, 0, Reg::Cx, 1 ), rax } },
+             { Cmp, { operand::imm( output_buffer ), rax } },
+             { Jae, { operand::sym( ".Lputs_direct" ) } },
+             { Add, { operand::imm( "__outbuf" ), rdi } },
+             { RepMovsb },
+             { Mov, { rax, operand::mem( "__outpos" ) } },
+             { Ret },
+             label( ".Lputs_direct" ),
+             { Push, { rsi } },
+             { Push, { rcx } },
+             { Call, { operand::sym( "__flush" ) } },
+             { Pop, { rdx } },
+             { Pop, { rsi } },
+             { Mov, { operand::imm( 1 ), rax } },
+             { Mov, { operand::imm( 1 ), rdi } },
+             { Syscall },
+             { Ret } };
+}
+
+// open( __profile_path, O_WRONLY | O_CREAT | O_TRUNC, 0644 ), two writes and close;
+// the kernel keeps %rdi across the syscalls
+std::vector< instruction > target_x86_64::profile_writer( int64_t counters ) const {
+    using enum Opcode;
+    return { label( "__profile" ),
+             { Mov, { operand::imm( 2 ), rax } },
+             { Mov, { operand::imm( "__profile_path" ), rdi } },
+             { Mov, { operand::imm( 01101 ), rsi } },
+             { Mov, { operand::imm( 0644 ), rdx } },
+             { Syscall },
+             { Mov, { rax, rdi } },
+             { Mov, { operand::imm( 1 ), rax } },
+             { Mov, { operand::imm( "__profile_header" ), rsi } },
+             { Mov, { operand::imm( 16 ), rdx } },
+             { Syscall },
+             { Mov, { operand::imm( 1 ), rax } },
+             { Mov, { operand::imm( "__profile_counters" ), rsi } },
+             { Mov, { operand::imm( counters * word() ), rdx } },
+             { Syscall },
+             { Mov, { operand::imm( 3 ), rax } },
+             { Syscall },
+             { Ret } };
+}
@@ -1,11 +1,98 @@
+#include "assembler.hpp"
+#include "batch.hpp"
+#include "diagnostics.hpp"
+#include "elf.hpp"
+#include "interpreter.hpp"
 #include "lexer.hpp"
 #include "parser.hpp"
+#include "peephole.hpp"
+#include "server.hpp"
 
 #include <cassert>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <sstream>
 
-int main(){
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// every file the tests write goes in here
+static const fs::path& scratch(){
+    static const fs::path dir = []{
+        fs::path d = fs::temp_directory_path() / ( "tdc-tests-" + std::to_string( getpid() ) );
+        fs::create_directories( d );
+        return d;
+    }();
+    return dir;
+}
 
+static program compile_source( const std::string& source, options opts = {} ){
+    parser p( opts );
+    p.parse_source( source );
+    return p.compile();
+}
+
+struct outcome {
+    int status;
+    std::string output;
+};
+
+// writes p as an executable and runs it
+static outcome execute( const program& p, const std::string& name ){
+    fs::path exe = scratch() / name, out = scratch() / ( name + ".out" );
+    write_executable( p, exe.string() );
+    int status = std::system( ( exe.string() + " > " + out.string() ).c_str() );
+    std::ifstream in( out );
+    return { WIFEXITED( status ) ? WEXITSTATUS( status ) : -1,
+             std::string( std::istreambuf_iterator< char >( in ), std::istreambuf_iterator< char >() ) };
+}
 
+static size_t hits( const peephole& opt, const std::string& name ){
+    for( auto& [ pattern, n ] : opt.counters() ){
+        if( pattern == name ){
+            return n;
+        }
+    }
+    assert( !"no such pattern" );
+    return 0;
+}
+
+// code after the peephole optimizer, which must have applied pattern once
+static std::vector< instruction > rewritten( std::vector< instruction > code,
+                                             const std::string& pattern )
+{
+    peephole opt;
+    opt.run( code );
+    assert( hits( opt, pattern ) == 1 );
+    return code;
+}
+
+// the diagnostics of a call that has to fail with std::invalid_argument
+template< class F >
+static std::string rejection( F&& work ){
+    std::ostringstream log;
+    collect_diagnostics collect( log );
+    try {
+        work();
+    } catch( std::invalid_argument& ){
+        assert( !log.str().empty() );
+        return log.str();
+    }
+    assert( !"accepted" );
+    return "";
+}
+
+static void test_dictionary(){
     dictionary dict;
     std::string i = "Int";
 
@@ -16,21 +103,586 @@ int main(){
 
     dict.add_word( "Ind", Token::Operator );
     assert( dict.get_token( "Ind" ) == Token::Operator );
+}
+
+static void test_front_end(){
+    parser p;
+    p.parse( "examples/factorial.td" );
+    auto triples = p.to_triples();
+    assert( triples.size() == 4 );
+    for( auto& [ func, trips ] : triples ){
+        assert( !trips.empty() );
+    }
+    p.translate( ( scratch() / "factorial.s" ).string() );
+    assert( fs::file_size( scratch() / "factorial.s" ) > 0 );
+
+    // compiling reuses the triples instead of lowering again
+    uint64_t lowered = 0;
+    for( auto& [ func, trips ] : triples ){
+        lowered += trips.size();
+    }
+    assert( p.stats().count( "triples" ) == lowered );
+    assert( &p.to_triples() == &p.to_triples() );
+
+    uint64_t leaves = p.stats().count( "AST leaves" );
+    assert( leaves > 0 && p.stats().count( "AST nodes" ) > leaves );
+
+    // mistakes in the source are diagnosed, whatever reads the program next
+    auto returning = []( std::string value ){
+        return "int main ()\n{\n    return " + value + ";\n}\n";
+    };
+    compile_source( returning( "2147483647" ) );
+    for( std::string value : { "2147483648", "99999999999", "( 1 + 2", "1 + 2 )", "( )" } ){
+        std::string log = rejection( [ & ]{ compile_source( returning( value ) ); } );
+        assert( log.find( "line 3" ) != std::string::npos );
+        rejection( [ & ]{
+            parser vm;
+            vm.parse_source( returning( value ) );
+            vm.make_interpreter();
+        } );
+    }
+}
+
+static void test_batch(){
+    // a file that fails, for whatever reason, fails alone
+    fs::path big = scratch() / "big.td";
+    std::ofstream( big ) << "int main ()\n{\n    return 99999999999;\n}\n";
+    std::vector< std::string > inputs = { "examples/factorial.td", big.string() };
+    std::vector< std::string > outputs = { ( scratch() / "batch-factorial" ).string(),
+                                           ( scratch() / "batch-big" ).string() };
+    std::ostringstream log;
+    std::streambuf* cerr = std::cerr.rdbuf( log.rdbuf() );
+    statistics stats;
+    int status = batch( inputs, outputs, { .jobs = 2 }, {}, stats );
+    std::cerr.rdbuf( cerr );
 
-    lexer lex;
-//    lex.print_tokens();
+    assert( status == 1 );
+    assert( fs::exists( outputs[ 0 ] ) && !fs::exists( outputs[ 1 ] ) );
+    assert( log.str().find( big.string() + ":\n" ) != std::string::npos );
+    assert( log.str().find( "Literal out of range" ) != std::string::npos );
+    assert( log.str().find( "1 of 2 files failed" ) != std::string::npos );
+}
 
+static void test_writes(){
+    // a failed write is an error, not a truncated file and success
+    auto refused = []( auto&& write ){
+        try {
+            write();
+        } catch( fs::filesystem_error& ){
+            return true;
+        }
+        return false;
+    };
     parser p;
-    p.parse( "test.td" );
-    p.print_ast();
+    p.parse( "examples/factorial.td" );
+    program compiled = p.compile();
+    statistics stats;
+    std::string missing = ( scratch() / "missing" / "factorial" ).string();
+    assert( refused( [ & ]{ write_executable( compiled, "/dev/full" ); } ) );
+    assert( refused( [ & ]{ write_outputs( compiled, missing, true, false, stats ); } ) );
+    assert( refused( [ & ]{ p.write_ir( "/dev/full" ); } ) );
+    assert( refused( [ & ]{ p.translate( "/dev/full" ); } ) );
+    assert( !refused( [ & ]{ write_outputs( compiled, ( scratch() / "written" ).string(),
+                                            true, true, stats ); } ) );
+}
 
-    auto triples = p.to_triples();
-    for( auto [ func, trips ] : triples ){
-        std::cout << "Function: " << func << '\n';
-        for( auto t : trips ){
-            std::cout << " Keyword: " << int( t.keyword ) << " Op: " << int( t.op ) << '\n'
-                << " token1: " << int( t.arg1.first ) << " token2: " << int( t.arg2.first ) << '\n';
+static void test_peephole(){
+    using enum Opcode;
+    const operand eax = operand::r( Reg::Ax ), ebx = operand::r( Reg::Bx );
+    const operand esp = operand::r( Reg::Sp ), slot = operand::mem( Reg::Bp, -4 );
+
+    assert( rewritten( { { Push, { eax } }, { Pop, { eax } } }, "push-pop" ).empty() );
+    assert( rewritten( { { Push, { operand::imm( 3 ) } }, { Pop, { ebx } } }, "push-pop" )
+            == std::vector< instruction >( { { Mov, { operand::imm( 3 ), ebx } } } ) );
+    assert( rewritten( { { Add, { operand::imm( 0 ), esp } } }, "zero-esp-adjust" ).empty() );
+    assert( rewritten( { { Add, { operand::imm( 8 ), esp } }, { Sub, { operand::imm( 12 ), esp } } },
+                       "merge-esp-adjust" )
+            == std::vector< instruction >( { { Sub, { operand::imm( 4 ), esp } } } ) );
+    assert( rewritten( { { Mov, { eax, eax } } }, "self-move" ).empty() );
+    assert( rewritten( { { Mov, { eax, slot } }, { Mov, { slot, eax } } }, "store-reload" )
+            == std::vector< instruction >( { { Mov, { eax, slot } } } ) );
+
+    // pushing %esp pushes its value before the push
+    std::vector< instruction > kept = { { Push, { esp } }, { Pop, { eax } } };
+    peephole opt;
+    opt.run( kept );
+    assert( kept.size() == 2 );
+
+    // a literal condition is decided at compile time, never compared
+    for( std::string target : { "i386", "x86-64" } ){
+        for( std::string condition : { "5", "0" } ){
+            program p = compile_source( "int main ()\n{\n    int x = 1;\n    if ( " + condition
+                                        + " ) {\n        x = 2;\n    }\n    return x;\n}\n",
+                                        { .optimize = true, .target = target } );
+            for( auto& i : p.text ){
+                assert( i.operands.size() < 2
+                        || i.operands[ 1 ].kind != operand::Kind::Immediate );
+            }
+        }
+    }
+}
+
+static void test_folding(){
+    struct folding {
+        std::string expression;
+        int i386, x86_64;       // exit status of "return expression;"
+    };
+    const folding cases[] = {
+        { "( ( 2147483647 + 1 ) / 65536 ) - 32760", 8, 8 },
+        { "( 65536 * 65536 ) + 7", 7, 7 },
+        { "( ( 63870 * 99930 ) / 1000000 ) - 2000", 87, 4382 % 256 },
+        { "( 0 - 1 ) / 16777216", 255, 255 },
+    };
+    for( auto& c : cases ){
+        for( std::string target : { "i386", "x86-64" } ){
+            program p = compile_source( "int main ()\n{\n    int x = 0;\n    x = " + c.expression
+                                        + ";\n    return x;\n}\n", { .target = target } );
+            // folds that do not fit an immediate are left for run time
+            for( auto& i : p.text ){
+                for( auto& o : i.operands ){
+                    assert( o.kind != operand::Kind::Immediate
+                            || ( o.value >= INT32_MIN && o.value <= INT32_MAX ) );
+                }
+            }
+            int expected = target == "i386" ? c.i386 : c.x86_64;
+            assert( execute( p, "fold" ).status == expected );
+        }
+    }
+}
+
+static void test_strings(){
+    // an escaped quote does not end the string, so the | inside it stays text
+    for( std::string target : { "i386", "x86-64" } ){
+        program p = compile_source( "int main ()\n{\n    print \"a\\\"|b\\n\";\n"
+                                    "    print \"c|\\\\\";\n    printn 42;\n    return 0;\n}\n",
+                                    { .target = target } );
+        assert( execute( p, "strings" ).output == "a\"|b\nc|\\42\n" );
+    }
+}
+
+// the .text bytes as makes of code, or nothing when binutils are missing
+static std::optional< std::string > gnu_as( const std::vector< instruction >& code, int64_t word ){
+    fs::path source = scratch() / "encodings.s", object = scratch() / "encodings.o";
+    fs::path text = scratch() / "encodings.bin";
+    std::ofstream( source ) << to_string( code, word );
+    std::string as = std::string( "as " ) + ( word == 8 ? "--64" : "--32" ) + " -o " + object.string()
+                   + " " + source.string() + " && objcopy -O binary -j .text " + object.string()
+                   + " " + text.string();
+    if( std::system( ( as + " 2> /dev/null" ).c_str() ) != 0 ){
+        return std::nullopt;
+    }
+    std::ifstream in( text, std::ios::binary );
+    return std::string( std::istreambuf_iterator< char >( in ), std::istreambuf_iterator< char >() );
+}
+
+static void test_encodings(){
+    using enum Opcode;
+    for( int64_t word : { 4, 8 } ){
+        const operand ax = operand::r( Reg::Ax ), bx = operand::r( Reg::Bx );
+        const operand cx = operand::r( Reg::Cx ), dx = operand::r( Reg::Dx );
+        const operand sp = operand::r( Reg::Sp ), bp = operand::r( Reg::Bp );
+        const operand local = operand::mem( Reg::Bp, -8 ), arg = operand::mem( Reg::Bp, 16 );
+        const operand far = operand::mem( Reg::Bp, -4096 ), top = operand::mem( Reg::Sp, 4 );
+        std::vector< instruction > code = {
+            { Mov, { operand::imm( 5 ), ax } },
+            { Mov, { operand::imm( -1 ), local } },
+            { Mov, { operand::imm( 100000 ), far } },
+            { Mov, { ax, local } },
+            { Mov, { arg, ax } },
+            { Mov, { top, cx } },
+            { Mov, { ax, bx } },
+            { Mov, { sp, bp } },
+            { Mov, { operand::mem( Reg::Bp, -4, Reg::Ax, 4 ), dx } },
+            { Movb, { ax, operand::mem( Reg::Cx, 0 ) } },
+            { Lea, { operand::mem( Reg::Ax, 0, Reg::Ax, 2 ), ax } },
+            { Lea, { operand::mem( Reg::None, 8, Reg::Ax, 4 ), ax } },
+            { Lea, { operand::mem( Reg::Bp, 0 ), cx } },
+            { Push, { ax } },
+            { Push, { bp } },
+            { Push, { operand::imm( 7 ) } },
+            { Push, { operand::imm( 1000 ) } },
+            { Push, { arg } },
+            { Pop, { bx } },
+            { Add, { operand::imm( 1 ), ax } },
+            { Add, { operand::imm( 1000 ), bx } },
+            { Add, { bx, ax } },
+            { Add, { local, ax } },
+            { Add, { ax, local } },
+            { Add, { operand::imm( 8 ), sp } },
+            { Sub, { operand::imm( 16 ), sp } },
+            { Sub, { bx, ax } },
+            { Sub, { operand::imm( 3 ), local } },
+            { Xor, { dx, dx } },
+            { Cmp, { operand::imm( 0 ), local } },
+            { Cmp, { operand::imm( 4096 ), ax } },
+            { Cmp, { bx, ax } },
+            { Test, { ax, ax } },
+            { Imul, { operand::imm( 10 ), ax, ax } },
+            { Imul, { operand::imm( 1000 ), local, ax } },
+            { Imul, { bx, ax } },
+            { Imul, { local, ax } },
+            { Div, { bx } },
+            { Div, { local } },
+            { Neg, { ax } },
+            { Shr, { operand::imm( 1 ), ax } },
+            { Shr, { operand::imm( 3 ), ax } },
+            { Ret },
+            { Leave },
+            { RepMovsb },
+        };
+        if( word == 8 ){
+            const operand r8 = operand::r( Reg::R8 ), r9 = operand::r( Reg::R9 );
+            code.insert( code.end(), {
+                { Mov, { operand::imm( 6382529100 ), ax } },
+                { Mov, { r8, operand::mem( Reg::Bp, -16 ) } },
+                { Mov, { ax, r9 } },
+                { Mov, { operand::mem( Reg::R8, 8 ), ax } },
+                { Push, { r8 } },
+                { Pop, { r9 } },
+                { Add, { r9, r8 } },
+                { Syscall },
+            } );
+        } else {
+            code.push_back( { Int, { operand::imm( 0x80 ) } } );
+        }
+
+        auto expected = gnu_as( code, word );
+        if( !expected ){
+            std::cerr << "as not found, encodings not checked\n";
+            return;
+        }
+        // one instruction at a time, so a mismatch names its instruction
+        size_t at = 0;
+        for( auto& i : code ){
+            assembler a( word );
+            a.encode( i );
+            if( expected->compare( at, a.size(), a.bytes() ) != 0 ){
+                std::cerr << "encoding differs from as: " << to_string( i, word ) << '\n';
+                assert( false );
+            }
+            at += a.size();
+        }
+        assert( at == expected->size() );
+    }
+}
+
+static void test_interpreter(){
+    // what it prints and returns matches the compiled program on either word size
+    for( std::string name : { "factorial", "printer", "main", "arith", "calls", "branches" } ){
+        for( std::string target : { "i386", "x86-64" } ){
+            std::string path = "examples/" + name + ".td";
+            parser interpreted( { .target = target } );
+            interpreted.parse( path );
+            interpreter vm = interpreted.make_interpreter();
+            std::ostringstream out;
+            int64_t result = vm.run( out );
+
+            parser compiled( { .target = target } );
+            compiled.parse( path );
+            outcome native = execute( compiled.compile(), name );
+            assert( out.str() == native.output );
+            assert( ( result & 0xff ) == native.status );
         }
     }
-    p.translate( "out.s" );
+
+    // triples that refer past the tables are refused before anything runs
+    std::vector< function > functions = { { "main", Types::Int, {}, { Types::Int } },
+                                          { "f", Types::Int, { Types::Int }, {} } };
+    std::vector< int64_t > integers = { 1 };
+    std::vector< std::string > strings;
+    auto returning = []( Token token, key k ){
+        triple t;
+        t.keyword = Keywords::Return;
+        t.args = { { token, k } };
+        return t;
+    };
+    triple call;
+    call.op = Operators::Call;
+    call.args = { { Token::Function, 1 }, { Token::Literal, 0 } };
+    triple bare_add;
+    bare_add.op = Operators::Intplus;
+    bare_add.args = { { Token::Literal, 0 } };
+
+    const std::vector< std::vector< triple > > broken = {
+        { returning( Token::Identifier, 1 ) },
+        { returning( Token::Argument, 0 ) },
+        { returning( Token::Literal, 1 ) },
+        { returning( Token::Expression, 0 ) },
+        { returning( Token::Function, 0 ) },
+        { call },
+        { bare_add },
+    };
+    for( auto& main : broken ){
+        rejection( [ & ]{
+            interpreter( { { 0, main } }, functions, integers, strings, 4 ); } );
+    }
+    interpreter fine( { { 0, { returning( Token::Identifier, 0 ) } } },
+                      functions, integers, strings, 4 );
+    std::ostringstream out;
+    assert( fine.run( out ) == 0 );
+}
+
+static void test_cache(){
+    fs::path dir = scratch() / "cache";
+    // compiles factorial.td with the cache; returns how many functions came from it
+    auto build = [ & ]( options opts, std::string* text = nullptr ){
+        opts.cache = dir.string();
+        parser p( opts );
+        p.parse( "examples/factorial.td" );
+        program compiled = p.compile();
+        if( text ){
+            *text = to_string( compiled );
+        }
+        return p.stats().count( "cached functions" );
+    };
+
+    std::string fresh, cached;
+    assert( build( {}, &fresh ) == 0 );
+    assert( build( {}, &cached ) == 4 );
+    assert( cached == fresh );
+
+    // other flags make other code, so they miss until they were built once
+    assert( build( { .optimize = true } ) == 0 );
+    assert( build( { .target = "x86-64" } ) == 0 );
+    assert( build( { .optimize = true } ) == 4 );
+    assert( build( {} ) == 4 );
+
+    // a damaged entry is a miss, not a wrong build
+    for( auto& entry : fs::directory_iterator( dir ) ){
+        fs::resize_file( entry.path(), fs::file_size( entry.path() ) / 2 );
+    }
+    assert( build( {}, &cached ) == 0 );
+    assert( cached == fresh );
+
+    // so is one whose key matches but whose first instruction holds values
+    // no instruction has: opcode, operand count, kind, register and scale
+    for( auto [ at, value ] : { std::pair{ 0, 200 }, { 1, 5 }, { 2, 9 }, { 3, 99 }, { 5, 3 } } ){
+        for( auto& entry : fs::directory_iterator( dir ) ){
+            std::ifstream in( entry.path(), std::ios::binary );
+            std::string data( ( std::istreambuf_iterator< char >( in ) ),
+                              std::istreambuf_iterator< char >() );
+            in.close();
+            uint32_t id;
+            std::memcpy( &id, data.data(), 4 );
+            data[ 4 + id + 4 + at ] = char( value );
+            std::ofstream( entry.path(), std::ios::binary | std::ios::trunc ) << data;
+        }
+        assert( build( {}, &cached ) == 0 );
+        assert( cached == fresh );
+    }
+}
+
+struct reply {
+    std::string header;
+    std::string output;
+    std::string diagnostics;
+    bool closed = false;        // the server hung up after it
+};
+
+static void send_all( int fd, const std::string& data ){
+    for( size_t done = 0; done < data.size(); ){
+        ssize_t n = ::write( fd, data.data() + done, data.size() - done );
+        assert( n > 0 );
+        done += n;
+    }
+}
+
+static std::string receive_exactly( int fd, size_t count ){
+    std::string data( count, '\0' );
+    for( size_t done = 0; done < count; ){
+        ssize_t n = ::read( fd, data.data() + done, count - done );
+        assert( n > 0 );
+        done += n;
+    }
+    return data;
+}
+
+// the next answer on fd: a result with its payload, or an error line
+static reply receive_reply( int fd ){
+    reply r;
+    char c;
+    while( ::read( fd, &c, 1 ) == 1 && c != '\n' ){
+        r.header += c;
+    }
+    if( r.header.rfind( "result ", 0 ) == 0 ){
+        std::istringstream words( r.header );
+        std::string word, id;
+        int status;
+        size_t output, diagnostics;
+        words >> word >> id >> status >> output >> diagnostics;
+        r.output = receive_exactly( fd, output );
+        r.diagnostics = receive_exactly( fd, diagnostics );
+    } else {
+        r.closed = ::read( fd, &c, 1 ) == 0;
+    }
+    return r;
+}
+
+static void test_server(){
+    std::string path = ( scratch() / "server.socket" ).string();
+    pid_t server = fork();
+    if( server == 0 ){
+        _exit( serve( { .jobs = 2 }, path ) );
+    }
+
+    auto connect_to_server = [ & ]{
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        std::strcpy( address.sun_path, path.c_str() );
+        for( int attempt = 0; attempt < 500; ++attempt ){
+            int fd = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+            if( ::connect( fd, (sockaddr*)&address, sizeof( address ) ) == 0 ){
+                return fd;
+            }
+            ::close( fd );
+            usleep( 10000 );
+        }
+        assert( !"the server does not listen" );
+        return -1;
+    };
+    auto compile = [ & ]( int fd, const std::string& id, const std::string& source,
+                          const std::string& flags = "asm" ){
+        send_all( fd, "compile " + id + " " + std::to_string( source.size() ) + " " + flags
+                      + "\n" + source );
+        return receive_reply( fd );
+    };
+    auto program = []( const std::string& statement ){
+        return "int main ()\n{\n    " + statement + "\n}\n";
+    };
+
+    // bad programs, whatever they throw, fail alone and the connection goes on
+    int fd = connect_to_server();
+    reply r = compile( fd, "good", program( "return 3;" ) );
+    assert( r.header.rfind( "result good 0 ", 0 ) == 0 && r.output.find( "main" ) != std::string::npos );
+    for( std::string statement : { "return 99999999999;", "return ( 1 + 2;", "return x;" } ){
+        r = compile( fd, "bad", program( statement ) );
+        assert( r.header.rfind( "result bad 1 0 ", 0 ) == 0 && !r.diagnostics.empty() );
+    }
+    r = compile( fd, "exe", program( "return 3;" ), "exe -t x86-64 -O" );
+    assert( r.header.rfind( "result exe 0 ", 0 ) == 0 && r.output.rfind( "\x7f" "ELF", 0 ) == 0 );
+    ::close( fd );
+
+    // malformed headers are answered with an error and the connection is closed
+    for( std::string header : { std::string( "hello\n" ),
+                                std::string( "compile big 999999999999 asm\n" ),
+                                std::string( "compile x 1 -t pdp11\n" ),
+                                std::string( 4000, 'x' ) } )
+    {
+        fd = connect_to_server();
+        send_all( fd, header );
+        r = receive_reply( fd );
+        assert( r.header.rfind( "error ", 0 ) == 0 && r.closed );
+        ::close( fd );
+    }
+
+    fd = connect_to_server();
+    assert( compile( fd, "after", program( "return 0;" ) ).header.rfind( "result after 0 ", 0 ) == 0 );
+    ::close( fd );
+
+    ::kill( server, SIGTERM );
+    int status;
+    waitpid( server, &status, 0 );
+}
+
+static uint64_t get( const std::string& image, size_t at, int bytes ){
+    uint64_t value = 0;
+    for( int b = 0; b < bytes; ++b ){
+        value |= uint64_t( uint8_t( image[ at + b ] ) ) << ( 8 * b );
+    }
+    return value;
+}
+
+static void set( std::string& image, size_t at, uint64_t value, int bytes ){
+    for( int b = 0; b < bytes; ++b ){
+        image[ at + b ] = char( value >> ( 8 * b ) );
+    }
+}
+
+static void test_ir(){
+    fs::path path = scratch() / "factorial.ir";
+    std::string fresh;
+    {
+        parser p;
+        p.parse( "examples/factorial.td" );
+        fresh = to_string( p.compile() );
+        p.write_ir( path.string() );
+    }
+    std::ifstream in( path, std::ios::binary );
+    const std::string image( ( std::istreambuf_iterator< char >( in ) ),
+                             std::istreambuf_iterator< char >() );
+
+    // read back, it compiles to the same program and writes the same file
+    {
+        parser p;
+        p.read_ir( path.string() );
+        assert( to_string( p.compile() ) == fresh );
+        p.write_ir( ( scratch() / "again.ir" ).string() );
+        std::ifstream again( scratch() / "again.ir", std::ios::binary );
+        assert( std::string( std::istreambuf_iterator< char >( again ),
+                             std::istreambuf_iterator< char >() ) == image );
+    }
+
+    // the array offsets and counts follow the 8 byte magic and version
+    auto array = [ & ]( int n ){
+        return std::pair( get( image, 8 + 16 * n, 8 ), get( image, 16 + 16 * n, 8 ) );
+    };
+    auto [ function_at, functions ] = array( 0 );
+    auto [ triple_at, triples ] = array( 2 );
+    auto [ argument_at, arguments ] = array( 3 );
+
+    std::vector< std::string > broken;
+    auto damaged = [ & ]( size_t at, uint64_t value, int bytes ){
+        std::string copy = image;
+        set( copy, at, value, bytes );
+        broken.push_back( copy );
+    };
+    for( size_t a = 0; a < arguments; ++a ){
+        size_t at = argument_at + 16 * a;
+        Token token = Token( get( image, at, 4 ) );
+        if( token == Token::Identifier || token == Token::Argument || token == Token::Function
+         || token == Token::Literal || token == Token::Expression )
+        {
+            damaged( at + 8, 1000, 8 );
+        }
+        damaged( at, 99, 4 );
+    }
+    for( size_t t = 0; t < triples; ++t ){
+        size_t at = triple_at + 12 * t;
+        damaged( at, 99, 1 );
+        if( Keywords( get( image, at, 1 ) ) == Keywords::None ){
+            damaged( at + 1, 99, 1 );
+            damaged( at + 8, 0, 4 );        // no arguments
+        }
+    }
+    // a function without code, which others call, and a type that does not exist
+    damaged( function_at + 9, 0, 1 );
+    damaged( function_at + 8, 99, 1 );
+    assert( broken.size() > 3 * functions );
+
+    fs::path bad = scratch() / "broken.ir";
+    for( auto& b : broken ){
+        std::ofstream( bad, std::ios::binary | std::ios::trunc ) << b;
+        for( std::string target : { "i386", "x86-64" } ){
+            rejection( [ & ]{
+                parser p( { .target = target } );
+                p.read_ir( bad.string() );
+            } );
+        }
+    }
+}
+
+int main(){
+    test_dictionary();
+    test_front_end();
+    test_batch();
+    test_writes();
+    test_peephole();
+    test_folding();
+    test_strings();
+    test_encodings();
+    test_interpreter();
+    test_cache();
+    test_server();
+    test_ir();
+    fs::remove_all( scratch() );
 }